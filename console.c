@@ -91,8 +91,12 @@ void add_cmd(char *name, cmd_func_t operation, char *summary, char *param)
     *last_loc = cmd;
 }
 
-/* Add a new parameter */
-void add_param(char *name, int *valp, char *summary, setter_func_t setter)
+/* Add a new parameter whose values can also be set by name */
+void add_param_choices(char *name,
+                       int *valp,
+                       const char *const *choices,
+                       char *summary,
+                       setter_func_t setter)
 {
     param_element_t *next_param = param_list;
     param_element_t **last_loc = &param_list;
@@ -105,12 +109,19 @@ void add_param(char *name, int *valp, char *summary, setter_func_t setter)
         malloc_or_fail(sizeof(param_element_t), "add_param");
     param->name = name;
     param->valp = valp;
+    param->choices = choices;
     param->summary = summary;
     param->setter = setter;
     param->next = next_param;
     *last_loc = param;
 }
 
+/* Add a new parameter */
+void add_param(char *name, int *valp, char *summary, setter_func_t setter)
+{
+    add_param_choices(name, valp, NULL, summary, setter);
+}
+
 /* Parse a string into a command line */
 static char **parse_args(char *line, int *argcp)
 {
@@ -250,6 +261,47 @@ static bool do_quit(int argc, char *argv[])
     return ok;
 }
 
+/* Show the value of a parameter, by name if it has one */
+static void report_param(const param_element_t *param)
+{
+    const char *const *choice = param->choices;
+    for (int i = 0; choice && *choice && i < *param->valp; i++)
+        choice++;
+
+    if (choice && *choice && *param->valp >= 0)
+        report(1, "  %-12s%-12s | %s", param->name, *choice, param->summary);
+    else
+        report(1, "  %-12s%-12d | %s", param->name, *param->valp,
+               param->summary);
+}
+
+/* Look up the value named name among the choices of a parameter */
+static bool get_choice(const param_element_t *param, char *name, int *loc)
+{
+    if (!param->choices)
+        return false;
+
+    for (int i = 0; param->choices[i]; i++) {
+        if (strcmp(param->choices[i], name) == 0) {
+            *loc = i;
+            return true;
+        }
+    }
+    return false;
+}
+
+/* Whether value stands for one of the choices of param */
+static bool valid_choice(const param_element_t *param, int value)
+{
+    if (value < 0)
+        return false;
+    for (int i = 0; param->choices[i]; i++) {
+        if (i == value)
+            return true;
+    }
+    return false;
+}
+
 static bool do_help(int argc, char *argv[])
 {
     cmd_element_t *clist = cmd_list;
@@ -262,8 +314,7 @@ static bool do_help(int argc, char *argv[])
     param_element_t *plist = param_list;
     report(1, "Options:");
     while (plist) {
-        report(1, "  %-12s%-12d | %s", plist->name, *plist->valp,
-               plist->summary);
+        report_param(plist);
         plist = plist->next;
     }
     return true;
@@ -301,8 +352,7 @@ static bool do_option(int argc, char *argv[])
         param_element_t *plist = param_list;
         report(1, "Options:");
         while (plist) {
-            report(1, "  %-12s%-12d | %s", plist->name, *plist->valp,
-                   plist->summary);
+            report_param(plist);
             plist = plist->next;
         }
         return true;
@@ -311,32 +361,37 @@ static bool do_option(int argc, char *argv[])
     for (int i = 1; i < argc; i++) {
         char *name = argv[i];
         int value = 0;
-        bool found = false;
+        /* Find parameter in list */
+        param_element_t *plist = param_list;
+        while (plist && strcmp(plist->name, name) != 0)
+            plist = plist->next;
+        /* Didn't find parameter */
+        if (!plist) {
+            report(1, "Unknown parameter '%s'", name);
+            return false;
+        }
         /* Get value from next argument */
         if (i + 1 >= argc) {
             report(1, "No value given for parameter %s", name);
             return false;
-        } else if (!get_int(argv[++i], &value)) {
-            report(1, "Cannot parse '%s' as integer", argv[i]);
+        } else if (!get_int(argv[++i], &value) &&
+                   !get_choice(plist, argv[i], &value)) {
+            if (plist->choices)
+                report(1, "Cannot parse '%s' as value of %s", argv[i], name);
+            else
+                report(1, "Cannot parse '%s' as integer", argv[i]);
             return false;
         }
-        /* Find parameter in list */
-        param_element_t *plist = param_list;
-        while (!found && plist) {
-            if (strcmp(plist->name, name) == 0) {
-                int oldval = *plist->valp;
-                *plist->valp = value;
-                if (plist->setter)
-                    plist->setter(oldval);
-                found = true;
-            } else
-                plist = plist->next;
-        }
-        /* Didn't find parameter */
-        if (!found) {
-            report(1, "Unknown parameter '%s'", name);
+        if (plist->choices && !valid_choice(plist, value)) {
+            report(1, "Value %d of %s out of range, not one of its choices",
+                   value, name);
             return false;
         }
+
+        int oldval = *plist->valp;
+        *plist->valp = value;
+        if (plist->setter)
+            plist->setter(oldval);
     }
 
     return true;
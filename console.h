@@ -34,6 +34,8 @@ typedef void (*setter_func_t)(int oldval);
 typedef struct __param_element {
     char *name;
     int *valp;
+    /* Optional NULL-terminated names of the values 0, 1, ... */
+    const char *const *choices;
     char *summary;
     /* Function that gets called whenever parameter changes */
     setter_func_t setter;
@@ -50,6 +52,16 @@ void add_cmd(char *name, cmd_func_t operation, char *summary, char *parameter);
 /* Add a new parameter */
 void add_param(char *name, int *valp, char *summary, setter_func_t setter);
 
+/* Add a new parameter whose values can also be set by name.
+ * choices is a NULL-terminated array naming the values 0, 1, ..., which are
+ * the only ones the parameter accepts.
+ */
+void add_param_choices(char *name,
+                       int *valp,
+                       const char *const *choices,
+                       char *summary,
+                       setter_func_t setter);
+
 /* Extract integer from text and store at loc */
 bool get_int(char *vname, int *loc);
 
@@ -1,12 +1,20 @@
 /* Test support code */
 
+#include <pthread.h>
 #include <setjmp.h>
 #include <signal.h>
+#include <stdatomic.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
 #include <unistd.h>
 
+#if defined(__linux__)
+#include <sys/syscall.h>
+#endif
+
 #include "report.h"
 
 /* Our program needs to use regular malloc/free */
@@ -27,6 +35,10 @@
 /* Byte to fill newly malloced space with */
 #define FILLCHAR 0x55
 
+/* Value right past the payload of every block in compact mode, unaligned */
+#define MAGICCANARY 0xcafed00d
+#define CANARY_SIZE sizeof(uint32_t)
+
 /* Data structures used by our code */
 
 /* Represent allocated blocks as doubly-linked list, with
@@ -40,54 +52,286 @@ typedef struct __block_element {
     /* Also place magic number at tail of every block */
 } block_element_t;
 
-static block_element_t *allocated = NULL;
-static size_t allocated_count = 0;
+/* Allocated blocks are spread over shards by address, each with its own
+ * lock, so that threads seldom wait for each other. A shard keeps its blocks
+ * on a list, for leak accounting, and in a hash set with open addressing and
+ * linear probing, so that cautious mode checks a block in constant time. The
+ * set is kept at most half full, and shrunk once less than an eighth full.
+ *
+ * In compact mode, blocks have neither header nor footer, and are only found
+ * through the set, which then holds their size too. A canary past the payload
+ * still catches overruns, and the payload itself is what the program asked
+ * for, so that memory looks the way it would without the harness.
+ */
+#define ALLOC_SHARDS 16
+#define LIVE_MIN_CAP 64
+#define SITES_MIN_CAP 64
+
+/**
+ * live_entry_t - Slot of the set of allocated blocks
+ * @block: what malloc() returned for the block, NULL for an empty slot
+ * @site: where the block was allocated from
+ * @size: size of the payload
+ */
+typedef struct {
+    void *block;
+    void *site;
+    size_t size;
+} live_entry_t;
+
+/**
+ * alloc_shard_t - Bookkeeping of a part of the allocated blocks
+ * @lock: serializes access to the rest of the shard
+ * @allocated: the blocks of this shard, but those of compact mode
+ * @count: number of blocks of this shard
+ * @live_set: the same blocks
+ * @live_cap: number of slots of @live_set, a power of two or zero
+ * @sites: statistics of the call sites, keyed by address, with open
+ *         addressing as well
+ * @sites_cap: number of slots of @sites, a power of two or zero
+ * @nr_sites: number of slots of @sites in use
+ * @hist: allocations by number of significant bits of their size
+ *
+ * Statistics are not freed, and only ever grow.
+ */
+typedef struct {
+    pthread_mutex_t lock;
+    block_element_t *allocated;
+    size_t count;
+    live_entry_t *live_set;
+    size_t live_cap;
+    alloc_site_t *sites;
+    size_t sites_cap, nr_sites;
+    size_t hist[ALLOC_HIST_BUCKETS];
+} __attribute__((aligned(64))) alloc_shard_t;
+
+static alloc_shard_t shards[ALLOC_SHARDS] = {
+    [0 ... ALLOC_SHARDS - 1] = {.lock = PTHREAD_MUTEX_INITIALIZER},
+};
 
 /* Percent probability of malloc failure */
 int fail_probability = 0;
 
+/* Fill one block in fill_sample with junk */
+int fill_sample = 1;
+
 static bool cautious_mode = true;
+static bool compact_mode = false;
 static bool noallocate_mode = false;
-static bool error_occurred = false;
-static char *error_message = "";
+static atomic_bool error_occurred = false;
+
+/* Milliseconds given to each operation with a time limit */
+int time_limit_ms = 1000;
+
+/* Data for managing exceptions, each thread unwinding to its own setup */
+static __thread sigjmp_buf env;
+static __thread volatile sig_atomic_t jmp_ready = false;
+static __thread volatile sig_atomic_t time_limited = false;
+static __thread char *error_message = "";
+
+/* End of the time given to the running operation, and when the timer of the
+ * thread is due to fire, or 0 if it is not armed. The timer is not disarmed
+ * past an operation, only armed again when it would fire too late or no more.
+ */
+static __thread volatile uint64_t op_deadline_ns = 0;
+static __thread volatile uint64_t timer_due_ns = 0;
+
+/* Start and duration of the last operation of each thread */
+static __thread uint64_t op_start_ns = 0;
+static __thread uint64_t op_latency_ns = 0;
 
-static int time_limit = 1;
+#if defined(__linux__)
+/* Not every C library names the thread a timer signals */
+#ifndef sigev_notify_thread_id
+#define sigev_notify_thread_id _sigev_un._tid
+#endif
 
-/* Data for managing exceptions */
-static jmp_buf env;
-static volatile sig_atomic_t jmp_ready = false;
-static bool time_limited = false;
+/* Timer of each thread, created on first use, or -1 if that failed and
+ * alarm() is used instead. It lives as long as the thread.
+ */
+static __thread timer_t op_timer;
+static __thread int op_timer_state = 0;
+#endif
+
+/* Seed of the failure injection, and how many times it was set. Each thread
+ * derives its own state from the seed, once it notices a new one.
+ */
+static pthread_mutex_t fail_seed_lock = PTHREAD_MUTEX_INITIALIZER;
+static unsigned int fail_seed_base = 0;
+static unsigned int fail_seed_users = 0;
+static atomic_uint fail_seed_gen = 1;
+
+/* State of the failure injection of each thread */
+static __thread unsigned int fail_seed;
+static __thread unsigned int fail_seed_seen = 0;
+
+/* Blocks allocated or freed by each thread since it last filled one */
+static __thread unsigned int fill_tick = 0;
 
 /* Internal functions */
 
 /* Should this allocation fail? */
 static bool fail_allocation()
 {
-    double weight = (double) random() / RAND_MAX;
+    if (!fail_probability)
+        return false;
+    unsigned int gen = atomic_load(&fail_seed_gen);
+    if (fail_seed_seen != gen) {
+        /* Threads get different states, in the order they ask for them */
+        pthread_mutex_lock(&fail_seed_lock);
+        fail_seed = fail_seed_base + fail_seed_users++ * 0x9e3779b9U;
+        pthread_mutex_unlock(&fail_seed_lock);
+        fail_seed_seen = gen;
+    }
+    double weight = (double) rand_r(&fail_seed) / RAND_MAX;
     return (weight < 0.01 * fail_probability);
 }
 
-/* Find header of block, given its payload.
- * Signal error if doesn't seem like legitimate block
+static inline uint64_t ptr_hash(const void *p)
+{
+    uint64_t h = ((uintptr_t) p >> 4) * 0x9e3779b97f4a7c15ULL;
+    return h ^ (h >> 32);
+}
+
+/* Shard in charge of a block, picked by other bits than the slots are */
+static inline alloc_shard_t *shard_of(const void *block)
+{
+    return &shards[(ptr_hash(block) >> 48) % ALLOC_SHARDS];
+}
+
+/* Return the slot of sh holding block, or the empty one where it would go */
+static size_t live_slot(const alloc_shard_t *sh, const void *block)
+{
+    size_t mask = sh->live_cap - 1, i = ptr_hash(block) & mask;
+    while (sh->live_set[i].block && sh->live_set[i].block != block)
+        i = (i + 1) & mask;
+    return i;
+}
+
+/* Move the blocks of the set of sh to a new table of cap slots */
+static bool live_resize(alloc_shard_t *sh, size_t cap)
+{
+    live_entry_t *set = calloc(cap, sizeof(live_entry_t));
+    if (!set)
+        return false;
+
+    live_entry_t *old = sh->live_set;
+    size_t old_cap = sh->live_cap;
+    sh->live_set = set;
+    sh->live_cap = cap;
+    for (size_t i = 0; i < old_cap; i++) {
+        if (old[i].block)
+            sh->live_set[live_slot(sh, old[i].block)] = old[i];
+    }
+    free(old);
+    return true;
+}
+
+static bool live_add(alloc_shard_t *sh, const live_entry_t *entry)
+{
+    if (2 * (sh->count + 1) > sh->live_cap &&
+        !live_resize(sh, sh->live_cap ? 2 * sh->live_cap : LIVE_MIN_CAP))
+        return false;
+    sh->live_set[live_slot(sh, entry->block)] = *entry;
+    return true;
+}
+
+/* Return the slot of block in the set of sh, or NULL if not there */
+static live_entry_t *live_find(const alloc_shard_t *sh, const void *block)
+{
+    if (!sh->live_cap)
+        return NULL;
+    live_entry_t *entry = &sh->live_set[live_slot(sh, block)];
+    return entry->block == block ? entry : NULL;
+}
+
+/* Take the block of entry, a slot of the set of sh, out of the set */
+static void live_remove(alloc_shard_t *sh, live_entry_t *entry)
+{
+    size_t mask = sh->live_cap - 1, i = entry - sh->live_set, j = i;
+
+    /* Shift back the blocks which would no longer be found past the hole */
+    for (;;) {
+        j = (j + 1) & mask;
+        if (!sh->live_set[j].block)
+            break;
+        size_t k = ptr_hash(sh->live_set[j].block) & mask;
+        if (((j - k) & mask) >= ((j - i) & mask)) {
+            sh->live_set[i] = sh->live_set[j];
+            i = j;
+        }
+    }
+    sh->live_set[i].block = NULL;
+
+    /* A failure to shrink leaves the set as it was */
+    if (sh->live_cap > LIVE_MIN_CAP && 8 * sh->count < sh->live_cap)
+        live_resize(sh, sh->live_cap / 2);
+}
+
+/* Return the statistics of site in sh, creating them if needed, or NULL if
+ * there is no room for them
  */
-static block_element_t *find_header(void *p)
+static alloc_site_t *site_find(alloc_shard_t *sh, void *site, bool create)
 {
-    if (!p) {
-        report_event(MSG_ERROR, "Attempting to free null block");
-        error_occurred = true;
+    if (create && 2 * (sh->nr_sites + 1) > sh->sites_cap) {
+        size_t cap = sh->sites_cap ? 2 * sh->sites_cap : SITES_MIN_CAP;
+        alloc_site_t *sites = calloc(cap, sizeof(alloc_site_t));
+        if (!sites)
+            return NULL;
+        for (size_t i = 0; i < sh->sites_cap; i++) {
+            if (!sh->sites[i].site)
+                continue;
+            size_t j = ptr_hash(sh->sites[i].site) & (cap - 1);
+            while (sites[j].site)
+                j = (j + 1) & (cap - 1);
+            sites[j] = sh->sites[i];
+        }
+        free(sh->sites);
+        sh->sites = sites;
+        sh->sites_cap = cap;
     }
+    if (!sh->sites_cap)
+        return NULL;
+
+    size_t mask = sh->sites_cap - 1, i = ptr_hash(site) & mask;
+    while (sh->sites[i].site && sh->sites[i].site != site)
+        i = (i + 1) & mask;
+    if (!sh->sites[i].site) {
+        if (!create)
+            return NULL;
+        sh->sites[i].site = site;
+        sh->nr_sites++;
+    }
+    return &sh->sites[i];
+}
+
+/* Number of significant bits of n */
+static inline int bit_length(size_t n)
+{
+    return n ? 64 - __builtin_clzll(n) : 0;
+}
+
+/* Should this block be filled with junk? */
+static inline bool fill_block()
+{
+    if (fill_sample <= 0)
+        return false;
+    if (++fill_tick < (unsigned int) fill_sample)
+        return false;
+    fill_tick = 0;
+    return true;
+}
 
+/* Find header of block, given its payload, with the lock of its shard held.
+ * Signal error if doesn't seem like legitimate block
+ */
+static block_element_t *find_header(const alloc_shard_t *sh, void *p)
+{
     block_element_t *b =
         (block_element_t *) ((size_t) p - sizeof(block_element_t));
     if (cautious_mode) {
         /* Make sure this is really an allocated block */
-        block_element_t *ab = allocated;
-        bool found = false;
-        while (ab && !found) {
-            found = ab == b;
-            ab = ab->next;
-        }
-        if (!found) {
+        if (!live_find(sh, b)) {
             report_event(MSG_ERROR,
                          "Attempted to free unallocated block.  Address = %p",
                          p);
@@ -115,9 +359,8 @@ static size_t *find_footer(block_element_t *b)
     return p;
 }
 
-/* Implementation of application functions */
-
-void *test_malloc(size_t size)
+/* Allocate a block of size bytes on behalf of the caller at site */
+static void *alloc_block(size_t size, void *site)
 {
     if (noallocate_mode) {
         report_event(MSG_FATAL, "Calls to malloc disallowed");
@@ -129,33 +372,115 @@ void *test_malloc(size_t size)
         return NULL;
     }
 
-    block_element_t *new_block =
-        malloc(size + sizeof(block_element_t) + sizeof(size_t));
-    if (!new_block) {
+    size_t extra = compact_mode ? CANARY_SIZE
+                                : sizeof(block_element_t) + sizeof(size_t);
+    void *block = malloc(size + extra);
+    if (!block) {
         report_event(MSG_FATAL, "Couldn't allocate any more memory");
         error_occurred = true;
+        return NULL;
     }
 
-    // cppcheck-suppress nullPointerRedundantCheck
-    new_block->magic_header = MAGICHEADER;
-    // cppcheck-suppress nullPointerRedundantCheck
-    new_block->payload_size = size;
-    *find_footer(new_block) = MAGICFOOTER;
-    void *p = (void *) &new_block->payload;
-    memset(p, FILLCHAR, size);
-    // cppcheck-suppress nullPointerRedundantCheck
-    new_block->next = allocated;
-    // cppcheck-suppress nullPointerRedundantCheck
-    new_block->prev = NULL;
-
-    if (allocated)
-        allocated->prev = new_block;
-    allocated = new_block;
-    allocated_count++;
+    void *p;
+    if (compact_mode) {
+        uint32_t canary = MAGICCANARY;
+        p = block;
+        memcpy((char *) p + size, &canary, CANARY_SIZE);
+    } else {
+        block_element_t *new_block = block;
+        new_block->magic_header = MAGICHEADER;
+        new_block->payload_size = size;
+        *find_footer(new_block) = MAGICFOOTER;
+        p = (void *) &new_block->payload;
+    }
+    if (fill_block())
+        memset(p, FILLCHAR, size);
+
+    alloc_shard_t *sh = shard_of(block);
+    live_entry_t entry = {.block = block, .site = site, .size = size};
+    pthread_mutex_lock(&sh->lock);
+    if (!live_add(sh, &entry)) {
+        pthread_mutex_unlock(&sh->lock);
+        report_event(MSG_FATAL, "Couldn't allocate any more memory");
+        error_occurred = true;
+        free(block);
+        return NULL;
+    }
+    if (!compact_mode) {
+        block_element_t *new_block = block;
+        new_block->next = sh->allocated;
+        new_block->prev = NULL;
+        if (sh->allocated)
+            sh->allocated->prev = new_block;
+        sh->allocated = new_block;
+    }
+    sh->count++;
+
+    /* Statistics which cannot be recorded are left out */
+    alloc_site_t *st = site_find(sh, site, true);
+    if (st) {
+        st->count++;
+        st->bytes += size;
+        st->live++;
+        st->live_bytes += size;
+    }
+    sh->hist[bit_length(size)]++;
+    pthread_mutex_unlock(&sh->lock);
 
     return p;
 }
 
+/* Forget about a block, with the lock of its shard held */
+static void release_block(alloc_shard_t *sh, live_entry_t *entry)
+{
+    sh->count--;
+    alloc_site_t *st = site_find(sh, entry->site, false);
+    if (st) {
+        st->live--;
+        st->live_bytes -= entry->size;
+    }
+    live_remove(sh, entry);
+}
+
+/* Free a block of compact mode, which can only be found through its shard */
+static void free_compact(void *p)
+{
+    alloc_shard_t *sh = shard_of(p);
+    pthread_mutex_lock(&sh->lock);
+    live_entry_t *entry = live_find(sh, p);
+    if (!entry) {
+        pthread_mutex_unlock(&sh->lock);
+        report_event(MSG_ERROR,
+                     "Attempted to free unallocated block.  Address = %p", p);
+        error_occurred = true;
+        return;
+    }
+
+    size_t size = entry->size;
+    uint32_t canary;
+    memcpy(&canary, (char *) p + size, CANARY_SIZE);
+    if (canary != MAGICCANARY) {
+        report_event(MSG_ERROR,
+                     "Corruption detected in block with address %p when "
+                     "attempting to free it",
+                     p);
+        error_occurred = true;
+    }
+    release_block(sh, entry);
+    pthread_mutex_unlock(&sh->lock);
+
+    if (fill_block())
+        memset(p, FILLCHAR, size + CANARY_SIZE);
+    free(p);
+}
+
+/* Implementation of application functions */
+
+void *test_malloc(size_t size)
+{
+    return alloc_block(size, __builtin_return_address(0));
+}
+
 // cppcheck-suppress unusedFunction
 void *test_calloc(size_t nelem, size_t elsize)
 {
@@ -163,8 +488,9 @@ void *test_calloc(size_t nelem, size_t elsize)
      * https://danluu.com/malloc-tutorial/
      */
     size_t size = nelem * elsize;  // TODO: check for overflow
-    void *ptr = test_malloc(size);
-    memset(ptr, 0, size);
+    void *ptr = alloc_block(size, __builtin_return_address(0));
+    if (ptr)
+        memset(ptr, 0, size);
     return ptr;
 }
 
@@ -178,7 +504,15 @@ void test_free(void *p)
     if (!p)
         return;
 
-    block_element_t *b = find_header(p);
+    if (compact_mode) {
+        free_compact(p);
+        return;
+    }
+
+    alloc_shard_t *sh =
+        shard_of((block_element_t *) ((size_t) p - sizeof(block_element_t)));
+    pthread_mutex_lock(&sh->lock);
+    block_element_t *b = find_header(sh, p);
     size_t footer = *find_footer(b);
     if (footer != MAGICFOOTER) {
         report_event(MSG_ERROR,
@@ -189,7 +523,8 @@ void test_free(void *p)
     }
     b->magic_header = MAGICFREE;
     *find_footer(b) = MAGICFREE;
-    memset(p, FILLCHAR, b->payload_size);
+    if (fill_block())
+        memset(p, FILLCHAR, b->payload_size);
 
     /* Unlink from list */
     block_element_t *bn = b->next;
@@ -197,19 +532,24 @@ void test_free(void *p)
     if (bp)
         bp->next = bn;
     else
-        allocated = bn;
+        sh->allocated = bn;
     if (bn)
         bn->prev = bp;
 
+    live_entry_t *entry = live_find(sh, b);
+    if (entry)
+        release_block(sh, entry);
+    else
+        sh->count--;
+    pthread_mutex_unlock(&sh->lock);
     free(b);
-    allocated_count--;
 }
 
 // cppcheck-suppress unusedFunction
 char *test_strdup(const char *s)
 {
     size_t len = strlen(s) + 1;
-    void *new = test_malloc(len);
+    void *new = alloc_block(len, __builtin_return_address(0));
     if (!new)
         return NULL;
 
@@ -218,7 +558,71 @@ char *test_strdup(const char *s)
 
 size_t allocation_check()
 {
-    return allocated_count;
+    size_t count = 0;
+    for (int i = 0; i < ALLOC_SHARDS; i++) {
+        pthread_mutex_lock(&shards[i].lock);
+        count += shards[i].count;
+        pthread_mutex_unlock(&shards[i].lock);
+    }
+    return count;
+}
+
+size_t alloc_overhead()
+{
+    return compact_mode ? CANARY_SIZE
+                        : sizeof(block_element_t) + sizeof(size_t);
+}
+
+static int site_cmp(const void *a, const void *b)
+{
+    const alloc_site_t *x = a, *y = b;
+    if (x->live_bytes != y->live_bytes)
+        return x->live_bytes < y->live_bytes ? 1 : -1;
+    return (x->bytes < y->bytes) - (x->bytes > y->bytes);
+}
+
+size_t alloc_sites(alloc_site_t *sites, size_t n)
+{
+    /* Gather the sites of all shards, a site being on several of them */
+    alloc_shard_t merged = {.sites = NULL};
+    for (int i = 0; i < ALLOC_SHARDS; i++) {
+        alloc_shard_t *sh = &shards[i];
+        pthread_mutex_lock(&sh->lock);
+        for (size_t j = 0; j < sh->sites_cap; j++) {
+            if (!sh->sites[j].site)
+                continue;
+            alloc_site_t *st = site_find(&merged, sh->sites[j].site, true);
+            if (!st)
+                continue;
+            st->count += sh->sites[j].count;
+            st->bytes += sh->sites[j].bytes;
+            st->live += sh->sites[j].live;
+            st->live_bytes += sh->sites[j].live_bytes;
+        }
+        pthread_mutex_unlock(&sh->lock);
+    }
+
+    size_t total = 0;
+    for (size_t j = 0; j < merged.sites_cap; j++) {
+        if (merged.sites[j].site)
+            merged.sites[total++] = merged.sites[j];
+    }
+    qsort(merged.sites, total, sizeof(alloc_site_t), site_cmp);
+    if (n && total)
+        memcpy(sites, merged.sites, (n < total ? n : total) * sizeof(*sites));
+    free(merged.sites);
+    return total;
+}
+
+void alloc_size_histogram(size_t hist[ALLOC_HIST_BUCKETS])
+{
+    memset(hist, 0, ALLOC_HIST_BUCKETS * sizeof(size_t));
+    for (int i = 0; i < ALLOC_SHARDS; i++) {
+        pthread_mutex_lock(&shards[i].lock);
+        for (int k = 0; k < ALLOC_HIST_BUCKETS; k++)
+            hist[k] += shards[i].hist[k];
+        pthread_mutex_unlock(&shards[i].lock);
+    }
 }
 
 /* Implementation of functions for testing */
@@ -231,6 +635,24 @@ void set_cautious_mode(bool cautious)
     cautious_mode = cautious;
 }
 
+void set_fail_seed(unsigned int seed)
+{
+    pthread_mutex_lock(&fail_seed_lock);
+    fail_seed_base = seed;
+    fail_seed_users = 0;
+    atomic_fetch_add(&fail_seed_gen, 1);
+    pthread_mutex_unlock(&fail_seed_lock);
+}
+
+/* Set/unset compact mode, refused while blocks are allocated */
+bool set_compact_mode(bool compact)
+{
+    if (compact != compact_mode && allocation_check())
+        return false;
+    compact_mode = compact;
+    return true;
+}
+
 /* Set/unset restricted allocation mode.
  * In this mode, calls to malloc and free are disallowed.
  */
@@ -242,35 +664,89 @@ void set_noallocate_mode(bool noallocate)
 /* Return whether any errors have occurred since last time set error limit */
 bool error_check()
 {
-    bool e = error_occurred;
-    error_occurred = false;
-    return e;
+    return atomic_exchange(&error_occurred, false);
+}
+
+static inline uint64_t now_ns()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
 }
 
-/* Prepare for a risky operation using setjmp.
- * Function returns true for initial return, false for error return
+/* Have SIGALRM sent to the calling thread in ns nanoseconds from now, with
+ * one system call
  */
-bool exception_setup(bool limit_time)
-{
-    if (sigsetjmp(env, 1)) {
-        /* Got here from longjmp */
-        jmp_ready = false;
-        if (time_limited) {
-            alarm(0);
-            time_limited = false;
-        }
+static void arm_time_limit(uint64_t now, uint64_t ns)
+{
+    timer_due_ns = now + ns;
+#if defined(__linux__)
+    if (!op_timer_state) {
+        struct sigevent sev = {
+            .sigev_notify = SIGEV_THREAD_ID,
+            .sigev_signo = SIGALRM,
+        };
+        sev.sigev_notify_thread_id = syscall(SYS_gettid);
+        op_timer_state =
+            timer_create(CLOCK_MONOTONIC, &sev, &op_timer) ? -1 : 1;
+    }
+    if (op_timer_state > 0) {
+        struct itimerspec its = {
+            .it_value = {.tv_sec = ns / 1000000000,
+                         .tv_nsec = ns % 1000000000},
+        };
+        timer_settime(op_timer, 0, &its, NULL);
+        return;
+    }
+#endif
+    /* Whole seconds only, rounded up */
+    unsigned secs = (ns + 999999999) / 1000000000;
+    timer_due_ns = now + secs * 1000000000ULL;
+    alarm(secs);
+}
 
-        if (error_message)
-            report_event(MSG_ERROR, error_message);
-        error_message = "";
+bool time_limit_exceeded()
+{
+    uint64_t now = now_ns();
+    timer_due_ns = 0;
+    if (!time_limited)
         return false;
-    }
+    if (now >= op_deadline_ns)
+        return true;
+
+    /* Left armed by an earlier operation, so wait out the rest */
+    arm_time_limit(now, op_deadline_ns - now);
+    return false;
+}
+
+sigjmp_buf *exception_env()
+{
+    return &env;
+}
+
+bool exception_unwound()
+{
+    jmp_ready = false;
+    op_latency_ns = now_ns() - op_start_ns;
+    time_limited = false;
 
-    /* Got here from initial call */
+    if (error_message)
+        report_event(MSG_ERROR, error_message);
+    error_message = "";
+    return false;
+}
+
+bool exception_enter(bool limit_time)
+{
     jmp_ready = true;
-    if (limit_time) {
-        alarm(time_limit);
+    op_start_ns = now_ns();
+    if (limit_time && time_limit_ms > 0) {
+        op_deadline_ns = op_start_ns + (uint64_t) time_limit_ms * 1000000;
         time_limited = true;
+        /* A timer due before the deadline is armed again when it fires */
+        uint64_t due = timer_due_ns;
+        if (due <= op_start_ns || due > op_deadline_ns)
+            arm_time_limit(op_start_ns, op_deadline_ns - op_start_ns);
     }
     return true;
 }
@@ -278,16 +754,19 @@ bool exception_setup(bool limit_time)
 /* Call once past risky code */
 void exception_cancel()
 {
-    if (time_limited) {
-        alarm(0);
-        time_limited = false;
-    }
-
+    op_latency_ns = now_ns() - op_start_ns;
+    time_limited = false;
     jmp_ready = false;
     error_message = "";
 }
 
-/* Use longjmp to return to most recent exception setup */
+uint64_t exception_latency()
+{
+    return op_latency_ns;
+}
+
+/* Use longjmp to return to most recent exception setup of the calling thread
+ */
 void trigger_exception(char *msg)
 {
     error_occurred = true;
@@ -4,10 +4,15 @@
 #include <setjmp.h>
 #include <stdarg.h>
 #include <stdbool.h>
+#include <stdint.h>
 
 /* This test harness enables us to do stringent testing of code.
  * It overloads the library versions of malloc and free with ones that
  * allow checking for common allocation errors.
+ *
+ * The allocation functions may be called from several threads at once.
+ * Exceptions are per thread: trigger_exception() returns to the most recent
+ * exception_setup() of the thread calling it.
  */
 
 void *test_malloc(size_t size);
@@ -21,15 +26,73 @@ char *test_strdup(const char *s);
 /* Report number of allocated blocks */
 size_t allocation_check();
 
+/* Buckets of the size histogram, bucket k counting the allocations of sizes
+ * in [2^(k-1), 2^k), bucket 0 those of size 0
+ */
+#define ALLOC_HIST_BUCKETS 65
+
+/**
+ * alloc_site_t - Allocations made from one call site
+ * @site: return address of the call to test_malloc() and friends
+ * @count: blocks ever allocated from @site
+ * @bytes: payload bytes of these blocks
+ * @live: blocks from @site not freed yet
+ * @live_bytes: payload bytes of these blocks
+ */
+typedef struct {
+    void *site;
+    size_t count, bytes;
+    size_t live, live_bytes;
+} alloc_site_t;
+
+/* Bytes the harness adds to every block around its payload, not counting
+ * the set of blocks of compact mode
+ */
+size_t alloc_overhead();
+
+/**
+ * alloc_sites() - Get the call sites allocating the most memory
+ * @sites: where to store the sites
+ * @n: room in @sites
+ *
+ * Sites are sorted by @live_bytes, the largest first, and then by @bytes.
+ *
+ * Return: the number of sites known, of which at most @n are stored
+ */
+size_t alloc_sites(alloc_site_t *sites, size_t n);
+
+/* Count the allocations ever made by bucket of their size */
+void alloc_size_histogram(size_t hist[ALLOC_HIST_BUCKETS]);
+
 /* Probability of malloc failing, expressed as percent */
 extern int fail_probability;
 
+/* Start the failures of malloc over from seed, so that the same allocations
+ * fail again. The threads to allocate next are given their own states, in
+ * the order they do it.
+ */
+void set_fail_seed(unsigned int seed);
+
+/* Fill one block in fill_sample with junk on malloc and free, none if 0 or
+ * less. Filling them all catches the most uses of uninitialized or freed
+ * memory, at the cost of touching all of it.
+ */
+extern int fill_sample;
+
 /*
  * Set/unset cautious mode.
  * In this mode, makes extra sure any block to be freed is currently allocated.
  */
 void set_cautious_mode(bool cautious);
 
+/*
+ * Set/unset compact mode.
+ * In this mode, blocks are only followed by a canary, and what the harness
+ * knows about them is kept apart. The mode cannot change while blocks are
+ * allocated, and false is returned for trying to.
+ */
+bool set_compact_mode(bool compact);
+
 /*
  * Set/unset restricted allocation mode.
  * In this mode, calls to malloc and free are disallowed.
@@ -39,14 +102,43 @@ void set_noallocate_mode(bool noallocate);
 /* Return whether any errors have occurred since last time checked */
 bool error_check();
 
+/* Milliseconds an operation gets when exception_setup() limits its time,
+ * without limit if 0 or less
+ */
+extern int time_limit_ms;
+
 /* Prepare for a risky operation using setjmp.
- * Function returns true for initial return, false for error return
+ * Evaluates to true for initial return, false for error return.
+ * A macro, since the jump buffer must be filled in the frame of the caller:
+ * a function calling sigsetjmp() would have returned by the time
+ * trigger_exception() jumps back into it.
  */
-bool exception_setup(bool limit_time);
+#define exception_setup(limit_time)                       \
+    (sigsetjmp(*exception_env(), 1) ? exception_unwound() \
+                                    : exception_enter(limit_time))
+
+/* Jump buffer of the calling thread, used by exception_setup() */
+sigjmp_buf *exception_env();
+
+/* Second half of exception_setup(), past an exception */
+bool exception_unwound();
+
+/* Second half of exception_setup(), on the initial return */
+bool exception_enter(bool limit_time);
 
 /* Call once past risky code */
 void exception_cancel();
 
+/* Call on SIGALRM: tell whether the operation of the calling thread ran out
+ * of time. A signal left over from an earlier operation is ignored.
+ */
+bool time_limit_exceeded();
+
+/* Nanoseconds from the last exception_setup() of the calling thread to its
+ * exception_cancel() or exception
+ */
+uint64_t exception_latency();
+
 /* Use longjmp to return to most recent exception setup.  Include error message
  */
 void trigger_exception(char *msg);
@@ -0,0 +1,59 @@
+#include <string.h>
+
+#include "histogram.h"
+
+/* Bucket of value v */
+static inline int hist_bucket(uint64_t v)
+{
+    if (v < 2 * HIST_SUB_BUCKETS)
+        return v;
+    int shift = 63 - __builtin_clzll(v) - HIST_SUB_BITS;
+    return (shift + 1) * HIST_SUB_BUCKETS + (v >> shift) - HIST_SUB_BUCKETS;
+}
+
+/* Largest value counted in bucket i */
+static inline uint64_t hist_bucket_max(int i)
+{
+    if (i < 2 * HIST_SUB_BUCKETS)
+        return i;
+    int shift = i / HIST_SUB_BUCKETS - 1;
+    uint64_t base = i % HIST_SUB_BUCKETS + HIST_SUB_BUCKETS;
+    return ((base + 1) << shift) - 1;
+}
+
+void hist_reset(histogram_t *h)
+{
+    memset(h, 0, sizeof(*h));
+}
+
+void hist_record(histogram_t *h, uint64_t v)
+{
+    h->count++;
+    h->sum += v;
+    if (v > h->max)
+        h->max = v;
+    h->buckets[hist_bucket(v)]++;
+}
+
+uint64_t hist_percentile(const histogram_t *h, double p)
+{
+    if (!h->count)
+        return 0;
+
+    /* Rank of the value sought, counting from 1 */
+    uint64_t rank = (uint64_t) (p / 100 * h->count + 0.5);
+    if (rank < 1)
+        rank = 1;
+    if (rank > h->count)
+        rank = h->count;
+
+    uint64_t seen = 0;
+    for (int i = 0; i < HIST_BUCKETS; i++) {
+        seen += h->buckets[i];
+        if (seen >= rank) {
+            uint64_t v = hist_bucket_max(i);
+            return v < h->max ? v : h->max;
+        }
+    }
+    return h->max;
+}
@@ -0,0 +1,51 @@
+#ifndef LAB0_HISTOGRAM_H
+#define LAB0_HISTOGRAM_H
+
+/* Histograms of durations, or any other non-negative integers.
+ *
+ * Values are counted in log-linear buckets, the way HdrHistogram does: every
+ * power of two is split into HIST_SUB_BUCKETS buckets of equal width, so a
+ * value is known within 1 / HIST_SUB_BUCKETS of itself, whatever its size,
+ * and values below 2 * HIST_SUB_BUCKETS exactly.
+ */
+
+#include <stdint.h>
+
+/* Buckets per power of two, a power of two itself */
+#define HIST_SUB_BITS 5
+#define HIST_SUB_BUCKETS (1 << HIST_SUB_BITS)
+
+/* Buckets for all 64-bit values */
+#define HIST_BUCKETS ((65 - HIST_SUB_BITS) * HIST_SUB_BUCKETS)
+
+/**
+ * histogram_t - Distribution of values
+ * @count: number of values recorded
+ * @sum: sum of the values, to get their mean
+ * @max: largest value recorded
+ * @buckets: number of values in each bucket
+ */
+typedef struct {
+    uint64_t count;
+    uint64_t sum;
+    uint64_t max;
+    uint64_t buckets[HIST_BUCKETS];
+} histogram_t;
+
+/* Forget every value recorded in h */
+void hist_reset(histogram_t *h);
+
+/* Count value v in h */
+void hist_record(histogram_t *h, uint64_t v);
+
+/**
+ * hist_percentile() - Estimate a percentile of the values of a histogram
+ * @h: the histogram
+ * @p: percentage of the values at most as large as the result, 0 to 100
+ *
+ * Return: the largest value of the bucket holding the percentile, but never
+ * more than the largest value recorded, or 0 if @h is empty
+ */
+uint64_t hist_percentile(const histogram_t *h, double p);
+
+#endif /* LAB0_HISTOGRAM_H */
@@ -0,0 +1,308 @@
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+#include "lfqueue.h"
+
+/* Hazard pointers per handle: dequeue protects the head and its successor,
+ * enqueue the tail.
+ */
+#define LFQ_HAZARDS 2
+
+/* Retired nodes a handle keeps on top of the ones which may be protected,
+ * before it scans the hazard pointers
+ */
+#define LFQ_SCAN_MIN 64
+
+#define LFQ_CACHE_LINE 64
+
+/**
+ * lfq_node_t - Node of a concurrent queue
+ * @next: next node, NULL for the tail
+ * @e: element held, meaningless for the dummy node at the head
+ * @retired: next node retired by the same handle
+ */
+typedef struct lfq_node {
+    _Atomic(struct lfq_node *) next;
+    element_t *e;
+    struct lfq_node *retired;
+} lfq_node_t;
+
+/**
+ * struct lfq_handle - Per-thread state of a concurrent queue
+ * @hp: nodes the thread may be reading, which must not be freed
+ * @active: whether a thread owns this handle
+ * @q: queue this handle belongs to
+ * @next: next handle of the queue, never changed once the handle is shared
+ * @retired: nodes removed from the queue, waiting to be freed
+ * @nr_retired: number of nodes on @retired
+ * @retries: operations started over since the handle was attached
+ *
+ * Handles are padded to a cache line, so that publishing hazard pointers
+ * does not slow down other threads.
+ */
+struct lfq_handle {
+    _Atomic(lfq_node_t *) hp[LFQ_HAZARDS];
+    atomic_bool active;
+    lfqueue_t *q;
+    struct lfq_handle *next;
+    lfq_node_t *retired;
+    size_t nr_retired;
+    size_t retries;
+    char pad[LFQ_CACHE_LINE];
+};
+
+/**
+ * struct lfqueue - Concurrent queue
+ * @head: dummy node, followed by the nodes of the elements in the queue
+ * @tail: last or next to last node
+ * @handles: every handle ever attached to the queue
+ * @nr_handles: number of handles on @handles
+ *
+ * Producers and consumers touch different cache lines, whatever the
+ * alignment the allocator gives.
+ */
+struct lfqueue {
+    _Atomic(lfq_node_t *) head;
+    char pad_head[LFQ_CACHE_LINE];
+    _Atomic(lfq_node_t *) tail;
+    char pad_tail[LFQ_CACHE_LINE];
+    _Atomic(lfq_handle_t *) handles;
+    atomic_size_t nr_handles;
+};
+
+lfqueue_t *lfq_new(void)
+{
+    lfqueue_t *q = malloc(sizeof(lfqueue_t));
+    lfq_node_t *dummy = malloc(sizeof(lfq_node_t));
+    if (!q || !dummy) {
+        free(q);
+        free(dummy);
+        return NULL;
+    }
+
+    atomic_init(&dummy->next, NULL);
+    dummy->e = NULL;
+    atomic_init(&q->head, dummy);
+    atomic_init(&q->tail, dummy);
+    atomic_init(&q->handles, NULL);
+    atomic_init(&q->nr_handles, 0);
+    return q;
+}
+
+static void lfq_free_retired(lfq_node_t *node)
+{
+    while (node) {
+        lfq_node_t *next = node->retired;
+        free(node);
+        node = next;
+    }
+}
+
+void lfq_free(lfqueue_t *q)
+{
+    if (!q)
+        return;
+
+    lfq_node_t *node = atomic_load(&q->head);
+    while (node) {
+        lfq_node_t *next = atomic_load(&node->next);
+        free(node);
+        node = next;
+    }
+
+    lfq_handle_t *h = atomic_load(&q->handles);
+    while (h) {
+        lfq_handle_t *next = h->next;
+        lfq_free_retired(h->retired);
+        free(h);
+        h = next;
+    }
+    free(q);
+}
+
+lfq_handle_t *lfq_attach(lfqueue_t *q)
+{
+    if (!q)
+        return NULL;
+
+    lfq_handle_t *h;
+    for (h = atomic_load(&q->handles); h; h = h->next) {
+        bool idle = false;
+        if (atomic_compare_exchange_strong(&h->active, &idle, true)) {
+            h->retries = 0;
+            return h;
+        }
+    }
+
+    h = malloc(sizeof(lfq_handle_t));
+    if (!h)
+        return NULL;
+    for (int i = 0; i < LFQ_HAZARDS; i++)
+        atomic_init(&h->hp[i], NULL);
+    atomic_init(&h->active, true);
+    h->q = q;
+    h->retired = NULL;
+    h->nr_retired = 0;
+    h->retries = 0;
+
+    h->next = atomic_load(&q->handles);
+    while (!atomic_compare_exchange_weak(&q->handles, &h->next, h))
+        ;
+    atomic_fetch_add(&q->nr_handles, 1);
+    return h;
+}
+
+static int lfq_ptr_cmp(const void *a, const void *b)
+{
+    uintptr_t x = (uintptr_t) *(lfq_node_t *const *) a;
+    uintptr_t y = (uintptr_t) *(lfq_node_t *const *) b;
+    return (x > y) - (x < y);
+}
+
+/* Free the nodes retired by h which no hazard pointer protects */
+static void lfq_scan(lfq_handle_t *h)
+{
+    /* Handles attached after the snapshot cannot protect retired nodes,
+     * which are no longer reachable from the queue.
+     */
+    lfq_handle_t *first = atomic_load(&h->q->handles), *p;
+    size_t cap = 0, n = 0;
+    for (p = first; p; p = p->next)
+        cap += LFQ_HAZARDS;
+    lfq_node_t **hazards = malloc(cap * sizeof(lfq_node_t *));
+    if (!hazards)
+        return;
+
+    for (p = first; p; p = p->next) {
+        for (int i = 0; i < LFQ_HAZARDS; i++) {
+            lfq_node_t *node = atomic_load(&p->hp[i]);
+            if (node)
+                hazards[n++] = node;
+        }
+    }
+    qsort(hazards, n, sizeof(lfq_node_t *), lfq_ptr_cmp);
+
+    lfq_node_t *node = h->retired, *next;
+    h->retired = NULL;
+    h->nr_retired = 0;
+    for (; node; node = next) {
+        next = node->retired;
+        if (bsearch(&node, hazards, n, sizeof(lfq_node_t *), lfq_ptr_cmp)) {
+            node->retired = h->retired;
+            h->retired = node;
+            h->nr_retired++;
+        } else {
+            free(node);
+        }
+    }
+    free(hazards);
+}
+
+/* Hand over a node removed from the queue, to be freed once unprotected */
+static void lfq_retire(lfq_handle_t *h, lfq_node_t *node)
+{
+    node->retired = h->retired;
+    h->retired = node;
+    if (++h->nr_retired >= LFQ_SCAN_MIN + LFQ_HAZARDS *
+                                              atomic_load(&h->q->nr_handles))
+        lfq_scan(h);
+}
+
+void lfq_detach(lfq_handle_t *h)
+{
+    if (!h)
+        return;
+    lfq_scan(h);
+    atomic_store(&h->active, false);
+}
+
+/* Publish a hazard pointer to the node src points to, and return that node
+ * once it is known to have been reachable after being protected
+ */
+static lfq_node_t *lfq_protect(lfq_handle_t *h,
+                               int i,
+                               _Atomic(lfq_node_t *) *src)
+{
+    lfq_node_t *node = atomic_load(src), *again;
+    for (;;) {
+        atomic_store(&h->hp[i], node);
+        again = atomic_load(src);
+        if (again == node)
+            return node;
+        node = again;
+        h->retries++;
+    }
+}
+
+bool lfq_enqueue(lfq_handle_t *h, element_t *e)
+{
+    lfq_node_t *node = malloc(sizeof(lfq_node_t));
+    if (!node)
+        return false;
+    atomic_init(&node->next, NULL);
+    node->e = e;
+
+    lfqueue_t *q = h->q;
+    for (;; h->retries++) {
+        lfq_node_t *tail = lfq_protect(h, 0, &q->tail);
+        lfq_node_t *next = atomic_load(&tail->next);
+        if (tail != atomic_load(&q->tail))
+            continue;
+
+        /* Help a lagging tail along before trying again */
+        if (next) {
+            atomic_compare_exchange_strong(&q->tail, &tail, next);
+            continue;
+        }
+        if (atomic_compare_exchange_weak(&tail->next, &next, node)) {
+            atomic_compare_exchange_strong(&q->tail, &tail, node);
+            break;
+        }
+    }
+    atomic_store(&h->hp[0], NULL);
+    return true;
+}
+
+element_t *lfq_dequeue(lfq_handle_t *h)
+{
+    lfqueue_t *q = h->q;
+    lfq_node_t *head;
+    element_t *e = NULL;
+    for (;; h->retries++) {
+        head = lfq_protect(h, 0, &q->head);
+        lfq_node_t *tail = atomic_load(&q->tail);
+        lfq_node_t *next = lfq_protect(h, 1, &head->next);
+        if (head != atomic_load(&q->head))
+            continue;
+
+        if (!next) {
+            head = NULL;
+            break;
+        }
+        /* The tail must never fall behind the head */
+        if (head == tail) {
+            atomic_compare_exchange_strong(&q->tail, &tail, next);
+            continue;
+        }
+        /* Only the consumer moving the head takes the element, which is
+         * read while next is still protected
+         */
+        if (atomic_compare_exchange_weak(&q->head, &head, next)) {
+            e = next->e;
+            break;
+        }
+    }
+    atomic_store(&h->hp[0], NULL);
+    atomic_store(&h->hp[1], NULL);
+
+    /* The old dummy goes, the node of e becomes the new one */
+    if (head)
+        lfq_retire(h, head);
+    return e;
+}
+
+size_t lfq_retries(const lfq_handle_t *h)
+{
+    return h->retries;
+}
@@ -0,0 +1,85 @@
+#ifndef LAB0_LFQUEUE_H
+#define LAB0_LFQUEUE_H
+
+/* Lock-free multi-producer multi-consumer queue of elements.
+ *
+ * This is the queue of Michael and Scott, with nodes reclaimed through
+ * hazard pointers. Elements are linked through nodes of the queue itself,
+ * so the same element_t used by queue.c can be passed between threads
+ * without being copied.
+ *
+ * References:
+ * M. M. Michael and M. L. Scott, "Simple, Fast, and Practical Non-Blocking
+ * and Blocking Concurrent Queue Algorithms", PODC 1996.
+ * M. M. Michael, "Hazard Pointers: Safe Memory Reclamation for Lock-Free
+ * Objects", IEEE TPDS 2004.
+ */
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "queue.h"
+
+typedef struct lfqueue lfqueue_t;
+typedef struct lfq_handle lfq_handle_t;
+
+/**
+ * lfq_new() - Create an empty concurrent queue
+ *
+ * Return: the new queue, or NULL for allocation failure
+ */
+lfqueue_t *lfq_new(void);
+
+/**
+ * lfq_free() - Free a concurrent queue
+ * @q: queue to free, which no thread may still be attached to
+ *
+ * Elements still in the queue are not freed. Drain the queue first when
+ * they have to be.
+ */
+void lfq_free(lfqueue_t *q);
+
+/**
+ * lfq_attach() - Get a handle through which the calling thread uses a queue
+ * @q: the queue to use
+ *
+ * Each thread needs a handle of its own, which holds its hazard pointers.
+ * Handles given up by lfq_detach() are handed out again.
+ *
+ * Return: the handle, or NULL for allocation failure
+ */
+lfq_handle_t *lfq_attach(lfqueue_t *q);
+
+/**
+ * lfq_detach() - Give up a handle
+ * @h: handle returned by lfq_attach()
+ */
+void lfq_detach(lfq_handle_t *h);
+
+/**
+ * lfq_enqueue() - Add an element at the tail of a queue
+ * @h: handle of the calling thread
+ * @e: element to add
+ *
+ * Return: true for success, false for allocation failure
+ */
+bool lfq_enqueue(lfq_handle_t *h, element_t *e);
+
+/**
+ * lfq_dequeue() - Take the element at the head of a queue
+ * @h: handle of the calling thread
+ *
+ * Return: the element, or NULL if the queue was empty
+ */
+element_t *lfq_dequeue(lfq_handle_t *h);
+
+/**
+ * lfq_retries() - Get the contention seen through a handle
+ * @h: the handle
+ *
+ * Return: number of times an operation through @h had to start over since
+ * the handle was attached, because another thread changed the queue first
+ */
+size_t lfq_retries(const lfq_handle_t *h);
+
+#endif /* LAB0_LFQUEUE_H */
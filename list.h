@@ -428,6 +428,157 @@ static inline void list_move_tail(struct list_head *node,
          &entry->member != (head); entry = safe,                           \
         safe = list_entry(safe->member.next, __typeof__(*entry), member))
 
+/**
+ * list_cmp_func_t - Comparison function used by list_sort
+ * @priv: private data passed through list_sort
+ * @a: pointer to the first list node
+ * @b: pointer to the second list node
+ *
+ * Return: >0 if @a has to be sorted after @b, <=0 otherwise
+ */
+typedef int (*list_cmp_func_t)(void *priv,
+                               const struct list_head *a,
+                               const struct list_head *b);
+
+/* Merge two null-terminated singly-linked runs, @a coming first on ties */
+static inline struct list_head *__list_merge(void *priv,
+                                             list_cmp_func_t cmp,
+                                             struct list_head *a,
+                                             struct list_head *b)
+{
+    struct list_head *head = NULL, **tail = &head;
+
+    for (;;) {
+        if (cmp(priv, a, b) <= 0) {
+            *tail = a;
+            tail = &a->next;
+            a = a->next;
+            if (!a) {
+                *tail = b;
+                break;
+            }
+        } else {
+            *tail = b;
+            tail = &b->next;
+            b = b->next;
+            if (!b) {
+                *tail = a;
+                break;
+            }
+        }
+    }
+    return head;
+}
+
+/* Merge the last two runs into @head and restore the prev links */
+static inline void __list_merge_final(void *priv,
+                                      list_cmp_func_t cmp,
+                                      struct list_head *head,
+                                      struct list_head *a,
+                                      struct list_head *b)
+{
+    struct list_head *tail = head;
+
+    for (;;) {
+        if (cmp(priv, a, b) <= 0) {
+            tail->next = a;
+            a->prev = tail;
+            tail = a;
+            a = a->next;
+            if (!a)
+                break;
+        } else {
+            tail->next = b;
+            b->prev = tail;
+            tail = b;
+            b = b->next;
+            if (!b) {
+                b = a;
+                break;
+            }
+        }
+    }
+
+    /* Splice the rest of the remaining run */
+    tail->next = b;
+    do {
+        b->prev = tail;
+        tail = b;
+        b = b->next;
+    } while (b);
+
+    tail->next = head;
+    head->prev = tail;
+}
+
+/**
+ * list_sort() - Sort the list nodes with a stable bottom-up merge sort
+ * @priv: private data passed to @cmp
+ * @head: pointer to the head of the list
+ * @cmp: comparison function
+ *
+ * The nodes are merged into runs whose lengths are powers of two. Pending
+ * runs are kept in a stack linked through their first node's prev pointer,
+ * while next pointers form null-terminated singly-linked runs. Adding the
+ * count-th node merges the two most recent runs of equal size 2^k, where k
+ * is the number of trailing one bits of count, so that no two pending runs
+ * are more than 2:1 in size. Only pointers are rewritten: the sort neither
+ * allocates memory nor uses stack space beyond a few local variables.
+ *
+ * Nodes comparing equal keep their relative order.
+ */
+static inline void list_sort(void *priv,
+                             struct list_head *head,
+                             list_cmp_func_t cmp)
+{
+    struct list_head *list = head->next, *pending = NULL;
+    size_t count = 0;
+
+    /* Zero or one node */
+    if (list == head->prev)
+        return;
+
+    /* Convert to a null-terminated singly-linked list */
+    head->prev->next = NULL;
+
+    do {
+        size_t bits;
+        struct list_head **tail = &pending;
+
+        /* Find the least-significant clear bit in count */
+        for (bits = count; bits & 1; bits >>= 1)
+            tail = &(*tail)->prev;
+        /* Merge the two runs of size 2^k if count is not 2^k - 1 */
+        if (bits) {
+            struct list_head *a = *tail, *b = a->prev;
+
+            a = __list_merge(priv, cmp, b, a);
+            a->prev = b->prev;
+            *tail = a;
+        }
+
+        /* Push a new run of one node */
+        list->prev = pending;
+        pending = list;
+        list = list->next;
+        pending->next = NULL;
+        count++;
+    } while (list);
+
+    /* Merge all the pending runs, from the smallest to the largest */
+    list = pending;
+    pending = pending->prev;
+    for (;;) {
+        struct list_head *next = pending->prev;
+
+        if (!next)
+            break;
+        list = __list_merge(priv, cmp, pending, list);
+        pending = next;
+    }
+    __list_merge_final(priv, cmp, head, pending, list);
+}
+
 #undef __LIST_HAVE_TYPEOF
 
 #ifdef __cplusplus
@@ -0,0 +1,147 @@
+#include <stdint.h>
+#include <stdlib.h>
+
+#include "harness.h"
+#include "pool.h"
+
+/* Number of objects carved from a slab when the pool runs dry */
+#define POOL_SLAB_OBJS 256
+
+/* Every object is preceded by a pointer to the slab it was carved from, so
+ * that it can find its way back to the owning pool when released.
+ */
+typedef struct {
+    struct list_head list;
+    pool_t *pool;
+    unsigned char objs[];
+} slab_t;
+
+static inline size_t obj_stride(const pool_t *pool)
+{
+    size_t size = (pool->obj_size + sizeof(void *) - 1) & ~(sizeof(void *) - 1);
+    return sizeof(slab_t *) + size;
+}
+
+static inline size_t bump_avail(const pool_t *pool)
+{
+    return (size_t) (pool->bump_end - pool->bump) / obj_stride(pool);
+}
+
+static void freelist_push(pool_t *pool, void *obj)
+{
+    *(void **) obj = pool->freelist;
+    if (!pool->freelist)
+        pool->freetail = obj;
+    pool->freelist = obj;
+    pool->nr_free++;
+}
+
+/* Move the never-used objects left in the bump region, which belongs to
+ * slab, onto the freelist.
+ */
+static void bump_drain(pool_t *pool, slab_t *slab)
+{
+    size_t stride = obj_stride(pool);
+    while (pool->bump != pool->bump_end) {
+        *(slab_t **) pool->bump = slab;
+        freelist_push(pool, pool->bump + sizeof(slab_t *));
+        pool->bump += stride;
+    }
+}
+
+/* Allocate a slab holding nr objects and make it the bump region.
+ * Whatever was left of the previous bump region goes to the freelist.
+ */
+static bool slab_new(pool_t *pool, size_t nr)
+{
+    size_t stride = obj_stride(pool);
+    if (nr > (SIZE_MAX - sizeof(slab_t)) / stride)
+        return false;
+
+    slab_t *slab = malloc(sizeof(slab_t) + nr * stride);
+    if (!slab)
+        return false;
+    slab->pool = pool;
+    if (!list_empty(&pool->slabs))
+        bump_drain(pool, list_first_entry(&pool->slabs, slab_t, list));
+    list_add(&slab->list, &pool->slabs);
+
+    pool->bump = slab->objs;
+    pool->bump_end = slab->objs + nr * stride;
+    return true;
+}
+
+void pool_init(pool_t *pool, size_t obj_size)
+{
+    INIT_LIST_HEAD(&pool->slabs);
+    pool->freelist = pool->freetail = NULL;
+    pool->bump = pool->bump_end = NULL;
+    pool->obj_size = obj_size;
+    pool->nr_free = 0;
+}
+
+void *pool_alloc(pool_t *pool)
+{
+    if (pool->freelist) {
+        void *obj = pool->freelist;
+        pool->freelist = *(void **) obj;
+        pool->nr_free--;
+        return obj;
+    }
+
+    if (pool->bump == pool->bump_end && !slab_new(pool, POOL_SLAB_OBJS))
+        return NULL;
+
+    /* The bump region always belongs to the most recent slab */
+    *(slab_t **) pool->bump = list_first_entry(&pool->slabs, slab_t, list);
+    void *obj = pool->bump + sizeof(slab_t *);
+    pool->bump += obj_stride(pool);
+    return obj;
+}
+
+void pool_free(void *obj)
+{
+    if (!obj)
+        return;
+    slab_t *slab = ((slab_t **) obj)[-1];
+    freelist_push(slab->pool, obj);
+}
+
+bool pool_reserve(pool_t *pool, size_t n)
+{
+    size_t avail = pool->nr_free + bump_avail(pool);
+    if (avail >= n)
+        return true;
+    n -= avail;
+    return slab_new(pool, n > POOL_SLAB_OBJS ? n : POOL_SLAB_OBJS);
+}
+
+void pool_merge(pool_t *dst, pool_t *src)
+{
+    slab_t *slab;
+    list_for_each_entry (slab, &src->slabs, list)
+        slab->pool = dst;
+
+    /* Keep the bump region of dst, recycle the one of src */
+    if (!list_empty(&src->slabs))
+        bump_drain(src, list_first_entry(&src->slabs, slab_t, list));
+
+    if (src->freelist) {
+        *(void **) src->freetail = dst->freelist;
+        if (!dst->freelist)
+            dst->freetail = src->freetail;
+        dst->freelist = src->freelist;
+        dst->nr_free += src->nr_free;
+    }
+
+    list_splice_tail(&src->slabs, &dst->slabs);
+    pool_init(src, src->obj_size);
+}
+
+void pool_destroy(pool_t *pool)
+{
+    slab_t *slab, *safe;
+    list_for_each_entry_safe (slab, safe, &pool->slabs, list)
+        free(slab);
+    pool_init(pool, pool->obj_size);
+}
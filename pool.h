@@ -0,0 +1,58 @@
+#ifndef LAB0_POOL_H
+#define LAB0_POOL_H
+
+/* Fixed-size object pool layered on top of the allocator in use.
+ *
+ * Objects are carved out of slabs, each slab being a single allocation.
+ * Released objects are kept on an intrusive freelist and handed out again
+ * before any new slab is requested, so the allocator sees one call per slab
+ * instead of one call per object. Destroying a pool releases all of its
+ * slabs at once, regardless of how many objects are still in use.
+ */
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "list.h"
+
+/**
+ * pool_t - A pool of objects sharing the same size
+ * @slabs: list of slabs owned by this pool
+ * @freelist: released objects, linked through their first word
+ * @freetail: last object on @freelist, used to splice freelists
+ * @bump: next never-used object in the most recent slab
+ * @bump_end: end of the most recent slab
+ * @obj_size: size of each object, as requested at initialization
+ * @nr_free: number of objects on @freelist
+ */
+typedef struct {
+    struct list_head slabs;
+    void *freelist, *freetail;
+    unsigned char *bump, *bump_end;
+    size_t obj_size;
+    size_t nr_free;
+} pool_t;
+
+/* Prepare an empty pool handing out objects of obj_size bytes */
+void pool_init(pool_t *pool, size_t obj_size);
+
+/* Return an object from the pool, or NULL when no slab can be allocated */
+void *pool_alloc(pool_t *pool);
+
+/* Give an object back to the pool it was allocated from */
+void pool_free(void *obj);
+
+/* Make sure the next n calls to pool_alloc() need no further allocation.
+ * Return false when the required slab cannot be allocated.
+ */
+bool pool_reserve(pool_t *pool, size_t n);
+
+/* Hand every slab of src over to dst, leaving src empty.
+ * Objects allocated from src remain valid and are released into dst.
+ */
+void pool_merge(pool_t *dst, pool_t *src);
+
+/* Release every slab of the pool, including objects still in use */
+void pool_destroy(pool_t *pool);
+
+#endif /* LAB0_POOL_H */
@@ -1,10 +1,21 @@
 /* Implementation of testing code for queue code */
 
+/* dladdr() names the call sites shown by allocstats */
+#if defined(__linux__) || defined(__GNU__)
+#define _GNU_SOURCE
+#endif
+
 #include <assert.h>
+#include <dlfcn.h>
 #include <errno.h>
 #include <getopt.h>
+#include <inttypes.h>
+#include <math.h>
+#include <pthread.h>
+#include <sched.h>
 #include <signal.h>
 #include <spawn.h>
+#include <stdatomic.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -45,6 +56,8 @@ extern int show_entropy;
 #include "queue.h"
 
 #include "console.h"
+#include "histogram.h"
+#include "lfqueue.h"
 #include "report.h"
 
 /* Settable parameters */
@@ -53,7 +66,6 @@ extern int show_entropy;
 
 /* How large is a queue before it's considered big.
  * This affects how it gets printed
- * and whether cautious mode is used when freeing the queue
  */
 #define BIG_LIST_SIZE 30
 
@@ -75,17 +87,89 @@ static int string_length = MAXSTRING;
 
 static int descend = 0;
 
+static int compact = 0;
+
 #define MIN_RANDSTR_LEN 5
 #define MAX_RANDSTR_LEN 10
+#define RAND_BATCH 4096
 static const char charset[] = "abcdefghijklmnopqrstuvwxyz";
+
+/* Generator of the random strings, and the seed it and the failures of
+ * malloc last started from
+ */
+static prng_t rng;
+static int seed = 0;
+/* Names of the values of sort_alg */
+static const char *const sort_algs[] = {"tim", "merge", "radix", NULL};
+
 /* For queue_insert and queue_remove */
 typedef enum {
     POS_TAIL,
     POS_HEAD,
 } position_t;
+/**
+ * cmd_stats_t - Latencies of the queue operations run by a command
+ * @name: name of the command
+ * @hist: their distribution, in nanoseconds
+ * @next: statistics of the next command, by name
+ */
+typedef struct cmd_stats {
+    char *name;
+    histogram_t hist;
+    struct cmd_stats *next;
+} cmd_stats_t;
+
+static cmd_stats_t *cmd_stats = NULL;
+
 /* Forward declarations */
 static bool q_show(int vlevel);
 
+static inline uint64_t now_ns()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+/* Count ns nanoseconds spent in the queue operations of command cmd, leaving
+ * out the parsing of its arguments and the checking of its results
+ */
+static void record_cmd_time(const char *cmd, uint64_t ns)
+{
+    cmd_stats_t **last_loc = &cmd_stats, *st = cmd_stats;
+    int cmp = 1;
+    while (st && (cmp = strcmp(cmd, st->name)) > 0) {
+        last_loc = &st->next;
+        st = st->next;
+    }
+
+    if (cmp) {
+        /* Losing the statistics of a command is not worth failing it */
+        st = malloc(sizeof(cmd_stats_t));
+        char *name = strdup(cmd);
+        if (!st || !name) {
+            free(st);
+            free(name);
+            return;
+        }
+        st->name = name;
+        hist_reset(&st->hist);
+        st->next = *last_loc;
+        *last_loc = st;
+    }
+    hist_record(&st->hist, ns);
+}
+
+static void cmd_stats_reset()
+{
+    while (cmd_stats) {
+        cmd_stats_t *next = cmd_stats->next;
+        free(cmd_stats->name);
+        free(cmd_stats);
+        cmd_stats = next;
+    }
+}
+
 static bool do_free(int argc, char *argv[])
 {
     if (argc != 1) {
@@ -101,9 +185,6 @@ static bool do_free(int argc, char *argv[])
     }
     error_check();
 
-    if (current && current->size > BIG_LIST_SIZE)
-        set_cautious_mode(false);
-
     struct list_head *qnext = NULL;
     if (chain.size > 1) {
         qnext = (current->chain.next == &chain.head) ? chain.head.next
@@ -116,7 +197,7 @@ static bool do_free(int argc, char *argv[])
         if (exception_setup(true))
             q_free(current->q);
         exception_cancel();
-        set_cautious_mode(true);
+        record_cmd_time(argv[0], exception_latency());
     }
 
     if (current) {
@@ -158,24 +239,19 @@ static bool do_new(int argc, char *argv[])
         current = qctx;
     }
     exception_cancel();
+    record_cmd_time(argv[0], exception_latency());
     q_show(3);
 
     return ok && !error_check();
 }
 
-/* TODO: Add a buf_size check of if the buf_size may be less
- * than MIN_RANDSTR_LEN.
+/* Fill n buffers of MAX_RANDSTR_LEN bytes, one after the other, with random
+ * strings of MIN_RANDSTR_LEN to MAX_RANDSTR_LEN - 1 characters
  */
-static void fill_rand_string(char *buf, size_t buf_size)
+static void fill_rand_strings(char *bufs, size_t n)
 {
-    size_t len = 0;
-    while (len < MIN_RANDSTR_LEN)
-        len = rand() % buf_size;
-
-    randombytes((uint8_t *) buf, len);
-    for (size_t n = 0; n < len; n++)
-        buf[n] = charset[buf[n] % (sizeof(charset) - 1)];
-    buf[len] = '\0';
+    random_strings(&rng, bufs, n, MAX_RANDSTR_LEN, MIN_RANDSTR_LEN, charset,
+                   sizeof(charset) - 1);
 }
 
 /* insertion */
@@ -197,8 +273,9 @@ static bool queue_insert(position_t pos, int argc, char *argv[])
         return ok;
     }
 
-    char *lasts = NULL;
-    char randstr_buf[MAX_RANDSTR_LEN];
+    /* Random strings are generated and inserted this many at a time */
+    static char randstr_bufs[RAND_BATCH][MAX_RANDSTR_LEN];
+    static const char *randstrs[RAND_BATCH];
     int reps = 1;
     bool ok = true, need_rand = false;
     if (argc != 2 && argc != 3) {
@@ -214,10 +291,8 @@ static bool queue_insert(position_t pos, int argc, char *argv[])
         }
     }
 
-    if (!strcmp(inserts, "RAND")) {
+    if (!strcmp(inserts, "RAND"))
         need_rand = true;
-        inserts = randstr_buf;
-    }
 
     if (!current || !current->q)
         report(3, "Warning: Calling insert %s on null queue",
@@ -225,35 +300,56 @@ static bool queue_insert(position_t pos, int argc, char *argv[])
     error_check();
 
     if (current && exception_setup(true)) {
-        for (int r = 0; ok && r < reps; r++) {
-            if (need_rand)
-                fill_rand_string(randstr_buf, sizeof(randstr_buf));
-            bool rval = pos == POS_TAIL ? q_insert_tail(current->q, inserts)
-                                        : q_insert_head(current->q, inserts);
+        uint64_t ns = 0;
+        for (int r = 0, batch; ok && r < reps; r += batch) {
+            bool rval;
+            const char *src = inserts;
+            uint64_t start;
+            if (need_rand) {
+                batch = reps - r < RAND_BATCH ? reps - r : RAND_BATCH;
+                fill_rand_strings(randstr_bufs[0], batch);
+                for (int i = 0; i < batch; i++)
+                    randstrs[i] = randstr_bufs[i];
+                src = randstrs[batch - 1];
+                start = now_ns();
+                rval = pos == POS_TAIL
+                           ? q_insert_tail_bulk(current->q, randstrs, batch)
+                           : q_insert_head_bulk(current->q, randstrs, batch);
+            } else {
+                batch = reps - r;
+                start = now_ns();
+                rval = pos == POS_TAIL
+                           ? q_insert_tail_repeat(current->q, inserts, batch)
+                           : q_insert_head_repeat(current->q, inserts, batch);
+            }
+            ns += now_ns() - start;
             if (rval) {
-                current->size++;
-                element_t *entry =
-                    pos == POS_TAIL
-                        ? list_last_entry(current->q, element_t, list)
-                        : list_first_entry(current->q, element_t, list);
+                current->size += batch;
+                /* Check the newest element against its neighbour */
+                q_iter_t it;
+                element_t *entry = pos == POS_TAIL
+                                       ? q_iter_last(current->q, &it)
+                                       : q_iter_first(current->q, &it);
+                element_t *near =
+                    pos == POS_TAIL ? q_iter_prev(&it) : q_iter_next(&it);
                 char *cur_inserts = entry->value;
                 if (!cur_inserts) {
                     report(1, "ERROR: Failed to save copy of string in queue");
                     ok = false;
-                } else if (r == 0 && inserts == cur_inserts) {
+                } else if (cur_inserts == src) {
                     report(1,
                            "ERROR: Need to allocate and copy string for new "
                            "queue element");
                     ok = false;
                     break;
-                } else if (r == 1 && lasts == cur_inserts) {
+                } else if (!intern_strings && r + batch > 1 && near &&
+                           near->value == cur_inserts) {
                     report(1,
                            "ERROR: Need to allocate separate string for each "
                            "queue element");
                     ok = false;
                     break;
                 }
-                lasts = cur_inserts;
             } else {
                 fail_count++;
                 if (fail_count < fail_limit)
@@ -267,6 +363,7 @@ static bool queue_insert(position_t pos, int argc, char *argv[])
             }
             ok = ok && !error_check();
         }
+        record_cmd_time(argv[0], ns);
     }
     exception_cancel();
 
@@ -310,8 +407,14 @@ static bool queue_remove(position_t pos, int argc, char *argv[])
     }
 #endif
 
-    if (argc != 1 && argc != 2) {
-        report(1, "%s needs 0-1 arguments", argv[0]);
+    if (argc > 3) {
+        report(1, "%s needs 0-2 arguments", argv[0]);
+        return false;
+    }
+
+    int reps = 1;
+    if (argc == 3 && (!get_int(argv[2], &reps) || reps < 1)) {
+        report(1, "Invalid number of removals '%s'", argv[2]);
         return false;
     }
 
@@ -330,73 +433,109 @@ static bool queue_remove(position_t pos, int argc, char *argv[])
         return false;
     }
 
-    bool check = argc > 1;
+    /* Any value goes for '*', and strings not compared are not copied */
+    bool check = argc > 1 && strcmp(argv[1], "*");
     bool ok = true;
     if (check) {
         strncpy(checks, argv[1], string_length + 1);
         checks[string_length] = '\0';
     }
 
-    removes[0] = '\0';
-    memset(removes + 1, 'X', string_length + STRINGPAD - 1);
-    removes[string_length + STRINGPAD] = '\0';
-
     if (!current || !current->size)
         report(3, "Warning: Calling remove %s on empty queue",
                pos == POS_TAIL ? "tail" : "head");
     error_check();
 
-    element_t *re = NULL;
-    if (current && exception_setup(true))
-        re = pos == POS_TAIL
-                 ? q_remove_tail(current->q, removes, string_length + 1)
-                 : q_remove_head(current->q, removes, string_length + 1);
-    exception_cancel();
+    if (current && exception_setup(true)) {
+        uint64_t ns = 0;
+        for (int r = 0; ok && r < reps; r++) {
+            if (check) {
+                /* Only the padding past the buffer handed out needs a known
+                 * value
+                 */
+                removes[0] = '\0';
+                memset(removes + string_length + 1, 'X', STRINGPAD - 1);
+                removes[string_length + STRINGPAD] = '\0';
+            }
 
-    bool is_null = re ? false : true;
+            element_t *re;
+            const char *value = NULL;
+            size_t len = 0;
+            uint64_t start = now_ns();
+            if (check)
+                re = pos == POS_TAIL
+                         ? q_remove_tail(current->q, removes, string_length + 1)
+                         : q_remove_head(current->q, removes,
+                                         string_length + 1);
+            else
+                re = pos == POS_TAIL
+                         ? q_remove_tail_nocopy(current->q, &value, &len)
+                         : q_remove_head_nocopy(current->q, &value, &len);
+            ns += now_ns() - start;
+
+            if (!re) {
+                fail_count++;
+                if (!check && fail_count < fail_limit) {
+                    report(2, "Removal from queue failed");
+                } else {
+                    report(1,
+                           "ERROR: Removal from queue failed (%d failures "
+                           "total)",
+                           fail_count);
+                    ok = false;
+                }
+                break;
+            }
+            current->size--;
 
-    if (!is_null) {
-        // q_remove_head and q_remove_tail are not responsible for releasing
-        // node
-        q_release_element(re);
+            if (!check) {
+                if (!value || strlen(value) != len) {
+                    report(1, "ERROR: Removed string or its length is wrong");
+                    ok = false;
+                } else {
+                    report(2, "Removed %s from queue", value);
+                }
+                /* The string goes with the element */
+                q_release_element(re);
+                ok = ok && !error_check();
+                continue;
+            }
 
-        removes[string_length + STRINGPAD] = '\0';
-        if (removes[0] == '\0') {
-            report(1, "ERROR: Failed to store removed value");
-            ok = false;
-        }
+            // q_remove_head and q_remove_tail are not responsible for
+            // releasing node
+            q_release_element(re);
 
-        /* Check whether padding in array removes are still initial value 'X'.
-         * If there's other character in padding, it's overflowed.
-         */
-        int i = string_length + 1;
-        while ((i < string_length + STRINGPAD) && (removes[i] == 'X'))
-            i++;
-        if (i != string_length + STRINGPAD) {
-            report(1,
-                   "ERROR: copying of string in remove_head overflowed "
-                   "destination buffer.");
-            ok = false;
-        } else {
-            report(2, "Removed %s from queue", removes);
-        }
-        current->size--;
-    } else {
-        fail_count++;
-        if (!check && fail_count < fail_limit) {
-            report(2, "Removal from queue failed");
-        } else {
-            report(1, "ERROR: Removal from queue failed (%d failures total)",
-                   fail_count);
-            ok = false;
-        }
-    }
+            removes[string_length + STRINGPAD] = '\0';
+            if (removes[0] == '\0') {
+                report(1, "ERROR: Failed to store removed value");
+                ok = false;
+            }
 
-    if (ok && check && strcmp(removes, checks)) {
-        report(1, "ERROR: Removed value %s != expected value %s", removes,
-               checks);
-        ok = false;
+            /* Check whether padding in array removes are still initial value
+             * 'X'. If there's other character in padding, it's overflowed.
+             */
+            int i = string_length + 1;
+            while ((i < string_length + STRINGPAD) && (removes[i] == 'X'))
+                i++;
+            if (i != string_length + STRINGPAD) {
+                report(1,
+                       "ERROR: copying of string in remove_head overflowed "
+                       "destination buffer.");
+                ok = false;
+            } else {
+                report(2, "Removed %s from queue", removes);
+            }
+
+            if (ok && strcmp(removes, checks)) {
+                report(1, "ERROR: Removed value %s != expected value %s",
+                       removes, checks);
+                ok = false;
+            }
+            ok = ok && !error_check();
+        }
+        record_cmd_time(argv[0], ns);
     }
+    exception_cancel();
 
     q_show(3);
 
@@ -415,10 +554,52 @@ static inline bool do_rt(int argc, char *argv[])
     return queue_remove(POS_TAIL, argc, argv);
 }
 
+/* Entry of the array used to find the duplicate strings of a queue */
+typedef struct {
+    const char *value;
+    size_t pos;
+} dup_entry_t;
+
+static int dup_entry_cmp(const void *a, const void *b)
+{
+    return strcmp(((const dup_entry_t *) a)->value,
+                  ((const dup_entry_t *) b)->value);
+}
+
+/* Tell for each of the n elements of l whether its string appears anywhere
+ * else in l. Return NULL if allocation failed.
+ */
+static bool *find_dups(struct list_head *l, size_t n)
+{
+    dup_entry_t *v = malloc((n ? n : 1) * sizeof(dup_entry_t));
+    bool *dups = calloc(n ? n : 1, sizeof(bool));
+    if (!v || !dups) {
+        free(v);
+        free(dups);
+        return NULL;
+    }
+
+    element_t *item;
+    size_t pos = 0;
+    list_for_each_entry (item, l, list) {
+        v[pos].value = item->value;
+        v[pos].pos = pos;
+        pos++;
+    }
+    qsort(v, n, sizeof(dup_entry_t), dup_entry_cmp);
+    for (size_t i = 0; i + 1 < n; i++) {
+        if (!strcmp(v[i].value, v[i + 1].value))
+            dups[v[i].pos] = dups[v[i + 1].pos] = true;
+    }
+    free(v);
+    return dups;
+}
+
 static bool do_dedup(int argc, char *argv[])
 {
-    if (argc != 1) {
-        report(1, "%s takes no arguments", argv[0]);
+    bool hash = argc == 2 && !strcmp(argv[1], "hash");
+    if (argc != 1 && !hash) {
+        report(1, "%s takes no arguments other than 'hash'", argv[0]);
         return false;
     }
 
@@ -429,10 +610,12 @@ static bool do_dedup(int argc, char *argv[])
 
     LIST_HEAD(l_copy);
     element_t *item = NULL, *tmp = NULL;
+    q_iter_t it;
 
     // Copy current->q to l_copy
-    if (current->q && !list_empty(current->q)) {
-        list_for_each_entry (item, current->q, list) {
+    if (current->q && q_size(current->q)) {
+        for (item = q_iter_first(current->q, &it); item;
+             item = q_iter_next(&it)) {
             size_t slen;
             tmp = malloc(sizeof(element_t));
             if (!tmp)
@@ -448,7 +631,7 @@ static bool do_dedup(int argc, char *argv[])
             list_add_tail(&tmp->list, &l_copy);
         }
         // Return false if the loop does not leave properly
-        if (&item->list != current->q) {
+        if (item) {
             list_for_each_entry_safe (item, tmp, &l_copy, list) {
                 free(item->value);
                 free(item);
@@ -460,22 +643,38 @@ static bool do_dedup(int argc, char *argv[])
         }
     }
 
+    /* Without sorting, any two equal strings are duplicates */
+    bool *dups = NULL;
+    if (hash && !(dups = find_dups(&l_copy, current->size))) {
+        list_for_each_entry_safe (item, tmp, &l_copy, list) {
+            free(item->value);
+            free(item);
+        }
+        report(1,
+               "INTERNAL ERROR.  Could not allocate space for duplicate "
+               "checking");
+        return false;
+    }
+
     bool ok = true;
     if (exception_setup(true))
-        ok = q_delete_dup(current->q);
+        ok = hash ? q_delete_dup_hash(current->q) : q_delete_dup(current->q);
     exception_cancel();
+    record_cmd_time(argv[0], exception_latency());
 
     if (!ok) {
         list_for_each_entry_safe (item, tmp, &l_copy, list) {
             free(item->value);
             free(item);
         }
+        free(dups);
         report(1, "ERROR: Calling delete duplicate on null queue");
         return false;
     }
 
-    struct list_head *l_tmp = current->q->next;
+    element_t *l_tmp = q_iter_first(current->q, &it);
     bool is_this_dup = false;
+    size_t pos = 0;
     // Compare between new list and old one
     list_for_each_entry (item, &l_copy, list) {
         // Skip comparison with new list if the string is duplicate
@@ -483,19 +682,17 @@ static bool do_dedup(int argc, char *argv[])
             item->list.next != &l_copy &&
             strcmp(list_entry(item->list.next, element_t, list)->value,
                    item->value) == 0;
-        if (is_this_dup || is_next_dup) {
+        if (hash ? dups[pos++] : is_this_dup || is_next_dup) {
             // Update list size
             current->size--;
-        } else if (l_tmp != current->q &&
-                   strcmp(list_entry(l_tmp, element_t, list)->value,
-                          item->value) == 0)
-            l_tmp = l_tmp->next;
+        } else if (l_tmp && strcmp(l_tmp->value, item->value) == 0)
+            l_tmp = q_iter_next(&it);
         else
             ok = false;
         is_this_dup = is_next_dup;
     }
     // All elements in new list should be traversed
-    ok = ok && l_tmp == current->q;
+    ok = ok && !l_tmp;
     if (!ok)
         report(1,
                "ERROR: Duplicate strings are in queue or distinct strings are "
@@ -505,6 +702,7 @@ static bool do_dedup(int argc, char *argv[])
         free(item->value);
         free(item);
     }
+    free(dups);
 
     q_show(3);
     return ok && !error_check();
@@ -525,6 +723,8 @@ static bool do_reverse(int argc, char *argv[])
     if (current && exception_setup(true))
         q_reverse(current->q);
     exception_cancel();
+    if (current)
+        record_cmd_time(argv[0], exception_latency());
 
     set_noallocate_mode(false);
     q_show(3);
@@ -562,6 +762,8 @@ static bool do_size(int argc, char *argv[])
         }
     }
     exception_cancel();
+    if (current)
+        record_cmd_time(argv[0], exception_latency());
 
     if (current && ok) {
         if (current->size == cnt) {
@@ -597,27 +799,36 @@ bool do_sort(int argc, char *argv[])
         report(3, "Warning: Calling sort on single node");
     error_check();
 
+    if (current && current->q && !q_sort_reserve(current->q))
+        report(3, "Warning: Could not reserve memory for sort, "
+                  "falling back to the default algorithm");
+    error_check();
+
     set_noallocate_mode(true);
     if (current && exception_setup(true))
         q_sort(current->q, descend);
     exception_cancel();
+    if (current)
+        record_cmd_time(argv[0], exception_latency());
     set_noallocate_mode(false);
+    q_sort_release();
+
+    if (current && current->q)
+        report(3, "Sorted with %zu comparisons", q_sort_comparisons());
 
     bool ok = true;
     if (current && current->size) {
-        for (struct list_head *cur_l = current->q->next;
-             cur_l != current->q && --cnt; cur_l = cur_l->next) {
+        q_iter_t it;
+        element_t *item = q_iter_first(current->q, &it), *next_item;
+        for (; --cnt && (next_item = q_iter_next(&it)); item = next_item) {
             /* Ensure each element in ascending/descending order */
-            element_t *item, *next_item;
-            item = list_entry(cur_l, element_t, list);
-            next_item = list_entry(cur_l->next, element_t, list);
-            if (!descend && strcmp(item->value, next_item->value) > 0) {
+            if (!descend && element_cmp(item, next_item) > 0) {
                 report(1, "ERROR: Not sorted in ascending order");
                 ok = false;
                 break;
             }
 
-            if (descend && strcmp(item->value, next_item->value) < 0) {
+            if (descend && element_cmp(item, next_item) < 0) {
                 report(1, "ERROR: Not sorted in descending order");
                 ok = false;
                 break;
@@ -646,6 +857,7 @@ static bool do_dm(int argc, char *argv[])
     if (exception_setup(true))
         ok = q_delete_mid(current->q);
     exception_cancel();
+    record_cmd_time(argv[0], exception_latency());
 
     if (!current->size)
         report(3, "Warning: Try to delete middle node to empty queue");
@@ -672,6 +884,7 @@ static bool do_swap(int argc, char *argv[])
     if (exception_setup(true))
         q_swap(current->q);
     exception_cancel();
+    record_cmd_time(argv[0], exception_latency());
 
     set_noallocate_mode(false);
 
@@ -703,18 +916,18 @@ static bool do_ascend(int argc, char *argv[])
 
     if (exception_setup(true))
         current->size = q_ascend(current->q);
+    exception_cancel();
+    record_cmd_time(argv[0], exception_latency());
     set_noallocate_mode(false);
 
     bool ok = true;
 
     cnt = current->size;
     if (current->size) {
-        for (struct list_head *cur_l = current->q->next;
-             cur_l != current->q && --cnt; cur_l = cur_l->next) {
-            element_t *item, *next_item;
-            item = list_entry(cur_l, element_t, list);
-            next_item = list_entry(cur_l->next, element_t, list);
-            if (strcmp(item->value, next_item->value) > 0) {
+        q_iter_t it;
+        element_t *item = q_iter_first(current->q, &it), *next_item;
+        for (; --cnt && (next_item = q_iter_next(&it)); item = next_item) {
+            if (element_cmp(item, next_item) > 0) {
                 report(1,
                        "ERROR: At least one node violated the ordering rule");
                 ok = false;
@@ -750,18 +963,18 @@ static bool do_descend(int argc, char *argv[])
 
     if (exception_setup(true))
         current->size = q_descend(current->q);
+    exception_cancel();
+    record_cmd_time(argv[0], exception_latency());
     set_noallocate_mode(false);
 
     bool ok = true;
 
     cnt = current->size;
     if (current->size) {
-        for (struct list_head *cur_l = current->q->next;
-             cur_l != current->q && --cnt; cur_l = cur_l->next) {
-            element_t *item, *next_item;
-            item = list_entry(cur_l, element_t, list);
-            next_item = list_entry(cur_l->next, element_t, list);
-            if (strcmp(item->value, next_item->value) < 0) {
+        q_iter_t it;
+        element_t *item = q_iter_first(current->q, &it), *next_item;
+        for (; --cnt && (next_item = q_iter_next(&it)); item = next_item) {
+            if (element_cmp(item, next_item) < 0) {
                 report(1,
                        "ERROR: At least one node violated the ordering rule");
                 ok = false;
@@ -798,6 +1011,7 @@ static bool do_reverseK(int argc, char *argv[])
     if (exception_setup(true))
         q_reverseK(current->q, k);
     exception_cancel();
+    record_cmd_time(argv[0], exception_latency());
 
     set_noallocate_mode(false);
     q_show(3);
@@ -817,14 +1031,27 @@ static bool do_merge(int argc, char *argv[])
     }
     error_check();
 
+    /* A queue of unknown order costs a full scan, so only look when the
+     * warning would be shown; the result is checked after the merge anyway.
+     */
+    if (verblevel >= 3) {
+        queue_contex_t *ctx;
+        list_for_each_entry (ctx, &chain.head, chain) {
+            if (ctx->q && !q_is_sorted(ctx->q, descend))
+                report(3, "Warning: Queue #%d is not sorted", ctx->id);
+        }
+    }
+
     int len = 0;
     set_noallocate_mode(true);
     if (current && exception_setup(true))
         len = q_merge(&chain.head, descend);
     exception_cancel();
+    if (current)
+        record_cmd_time(argv[0], exception_latency());
     set_noallocate_mode(false);
 
-    if (q_size(&chain.head) > 1) {
+    if (chain.size > 1) {
         chain.size = 1;
         current = list_entry(chain.head.next, queue_contex_t, chain);
         current->size = len;
@@ -843,13 +1070,11 @@ static bool do_merge(int argc, char *argv[])
 
     bool ok = true;
     if (current && current->size) {
-        for (struct list_head *cur_l = current->q->next;
-             cur_l != current->q && --len; cur_l = cur_l->next) {
+        q_iter_t it;
+        element_t *item = q_iter_first(current->q, &it), *next_item;
+        for (; --len && (next_item = q_iter_next(&it)); item = next_item) {
             /* Ensure each element in ascending order */
-            element_t *item, *next_item;
-            item = list_entry(cur_l, element_t, list);
-            next_item = list_entry(cur_l->next, element_t, list);
-            if (!descend && strcmp(item->value, next_item->value) > 0) {
+            if (!descend && element_cmp(item, next_item) > 0) {
                 report(1,
                        "ERROR: Not sorted in ascending order (It might because "
                        "of unsorted queues are merged or there're some flaws "
@@ -859,7 +1084,7 @@ static bool do_merge(int argc, char *argv[])
             }
 
 
-            if (descend && strcmp(item->value, next_item->value) < 0) {
+            if (descend && element_cmp(item, next_item) < 0) {
                 report(
                     1,
                     "ERROR: Not sorted in descending order (It might because "
@@ -912,12 +1137,12 @@ static bool q_show(int vlevel)
 
     report_noreturn(vlevel, "l = [");
 
-    struct list_head *ori = current->q;
-    struct list_head *cur = current->q->next;
+    q_iter_t it;
+    element_t *e = NULL;
 
     if (exception_setup(true)) {
-        while (ok && ori != cur && cnt < current->size) {
-            element_t *e = list_entry(cur, element_t, list);
+        e = q_iter_first(current->q, &it);
+        while (ok && e && cnt < current->size) {
             if (cnt < BIG_LIST_SIZE) {
                 report_noreturn(vlevel, cnt == 0 ? "%s" : " %s", e->value);
                 if (show_entropy) {
@@ -927,7 +1152,7 @@ static bool q_show(int vlevel)
                 }
             }
             cnt++;
-            cur = cur->next;
+            e = q_iter_next(&it);
             ok = ok && !error_check();
         }
     }
@@ -938,7 +1163,7 @@ static bool q_show(int vlevel)
         return false;
     }
 
-    if (cur == ori) {
+    if (!e) {
         if (cnt <= BIG_LIST_SIZE)
             report(vlevel, "]");
         else
@@ -953,6 +1178,591 @@ static bool q_show(int vlevel)
     return ok;
 }
 
+/* Most threads of either kind the stress command runs */
+#define STRESS_MAX_THREADS 256
+
+/**
+ * stress_t - State shared by the threads of the stress command
+ * @q: queue the strings go through
+ * @n: number of strings to move
+ * @produced: number of strings handed out to producers
+ * @consumed: number of strings taken out of the queue
+ * @seen: how many times each string came out
+ * @failed: set when a producer could not allocate, so consumers stop waiting
+ * @bad: number of strings coming out garbled
+ */
+typedef struct {
+    lfqueue_t *q;
+    size_t n;
+    atomic_size_t produced, consumed;
+    atomic_uchar *seen;
+    atomic_bool failed;
+    atomic_size_t bad;
+} stress_t;
+
+/* Per-thread argument of the stress command */
+typedef struct {
+    stress_t *st;
+    size_t retries;
+} stress_arg_t;
+
+/* Put strings holding their own index into the queue, until all n are out */
+static void *stress_producer(void *arg)
+{
+    stress_arg_t *a = arg;
+    stress_t *st = a->st;
+    lfq_handle_t *h = lfq_attach(st->q);
+    if (!h) {
+        atomic_store(&st->failed, true);
+        return NULL;
+    }
+
+    size_t i;
+    while ((i = atomic_fetch_add(&st->produced, 1)) < st->n) {
+        char buf[24];
+        int len = snprintf(buf, sizeof(buf), "%zu", i);
+        element_t *e = malloc(sizeof(element_t) + len + 1);
+        if (!e) {
+            atomic_store(&st->failed, true);
+            break;
+        }
+        e->value = e->data;
+        memcpy(e->value, buf, len + 1);
+        e->len = len;
+        e->key = element_key(e->value, len);
+        if (!lfq_enqueue(h, e)) {
+            free(e);
+            atomic_store(&st->failed, true);
+            break;
+        }
+    }
+    a->retries = lfq_retries(h);
+    lfq_detach(h);
+    return NULL;
+}
+
+/* Take strings out of the queue and tally them, until all n came out */
+static void *stress_consumer(void *arg)
+{
+    stress_arg_t *a = arg;
+    stress_t *st = a->st;
+    lfq_handle_t *h = lfq_attach(st->q);
+    if (!h) {
+        atomic_store(&st->failed, true);
+        return NULL;
+    }
+
+    while (atomic_load(&st->consumed) < st->n) {
+        element_t *e = lfq_dequeue(h);
+        if (!e) {
+            if (atomic_load(&st->failed))
+                break;
+            /* Let producers run when there are more threads than CPUs */
+            sched_yield();
+            continue;
+        }
+        char *end;
+        size_t i = strtoul(e->value, &end, 10);
+        if (*end || i >= st->n || (size_t) (end - e->value) != e->len)
+            atomic_fetch_add(&st->bad, 1);
+        else
+            atomic_fetch_add(&st->seen[i], 1);
+        atomic_fetch_add(&st->consumed, 1);
+        free(e);
+    }
+    a->retries = lfq_retries(h);
+    lfq_detach(h);
+    return NULL;
+}
+
+static bool do_stress(int argc, char *argv[])
+{
+    int np, nc, n;
+    if (argc != 4) {
+        report(1, "%s needs 3 arguments", argv[0]);
+        return false;
+    }
+    if (!get_int(argv[1], &np) || np < 1 || np > STRESS_MAX_THREADS ||
+        !get_int(argv[2], &nc) || nc < 1 || nc > STRESS_MAX_THREADS) {
+        report(1, "Numbers of producers and consumers must be 1 to %d",
+               STRESS_MAX_THREADS);
+        return false;
+    }
+    if (!get_int(argv[3], &n) || n < 1) {
+        report(1, "Invalid number of strings '%s'", argv[3]);
+        return false;
+    }
+
+    stress_t st = {.q = lfq_new(), .n = n};
+    atomic_init(&st.produced, 0);
+    atomic_init(&st.consumed, 0);
+    atomic_init(&st.failed, false);
+    atomic_init(&st.bad, 0);
+    st.seen = calloc(n, sizeof(atomic_uchar));
+    pthread_t *tid = malloc((np + nc) * sizeof(pthread_t));
+    stress_arg_t *args = calloc(np + nc, sizeof(stress_arg_t));
+    if (!st.q || !st.seen || !tid || !args) {
+        report(1, "INTERNAL ERROR.  Could not allocate space for stress test");
+        lfq_free(st.q);
+        free(st.seen);
+        free(tid);
+        free(args);
+        return false;
+    }
+
+    /* Keep signals on this thread, as the sort does */
+    sigset_t all, old;
+    sigfillset(&all);
+    pthread_sigmask(SIG_BLOCK, &all, &old);
+
+    struct timespec start, stop;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    int started = 0;
+    for (; started < np + nc; started++) {
+        args[started].st = &st;
+        if (pthread_create(&tid[started], NULL,
+                           started < np ? stress_producer : stress_consumer,
+                           &args[started]))
+            break;
+    }
+    pthread_sigmask(SIG_SETMASK, &old, NULL);
+
+    /* Without all threads, the ones waiting for strings may never be done */
+    if (started < np + nc)
+        atomic_store(&st.failed, true);
+    for (int i = 0; i < started; i++)
+        pthread_join(tid[i], NULL);
+    clock_gettime(CLOCK_MONOTONIC, &stop);
+
+    /* Whatever is left behind after a failure */
+    lfq_handle_t *h = lfq_attach(st.q);
+    element_t *e;
+    while (h && (e = lfq_dequeue(h)))
+        free(e);
+    lfq_detach(h);
+    lfq_free(st.q);
+
+    bool ok = !atomic_load(&st.failed);
+    if (!ok)
+        report(1, "ERROR: Could not run all threads or allocate all strings");
+
+    size_t lost = 0, dups = 0, retries = 0;
+    for (int i = 0; i < n; i++) {
+        unsigned char cnt = atomic_load(&st.seen[i]);
+        lost += !cnt;
+        dups += cnt > 1;
+    }
+    for (int i = 0; i < started; i++)
+        retries += args[i].retries;
+    if (ok && (lost || dups || atomic_load(&st.bad))) {
+        report(1, "ERROR: %zu strings lost, %zu duplicated, %zu garbled", lost,
+               dups, atomic_load(&st.bad));
+        ok = false;
+    }
+
+    if (ok) {
+        double secs = (stop.tv_sec - start.tv_sec) +
+                      (stop.tv_nsec - start.tv_nsec) * 1e-9;
+        report(1,
+               "%d strings, %d producers, %d consumers: %.3f s, %.0f "
+               "strings/s",
+               n, np, nc, secs, secs > 0 ? n / secs : 0.0);
+        report(1, "%zu retries, %.3f per string", retries,
+               (double) retries / n);
+    }
+
+    free(st.seen);
+    free(tid);
+    free(args);
+    return ok;
+}
+
+/* Queues merged by bench merge, and groups reversed by bench reverseK */
+#define BENCH_MERGE_QUEUES 4
+#define BENCH_K 8
+
+/* String inserted by bench ih and bench it */
+#define BENCH_STRING "bench"
+
+/* Operations bench can measure, in the order of bench_ops */
+typedef enum {
+    BENCH_IH,
+    BENCH_IT,
+    BENCH_RH,
+    BENCH_RT,
+    BENCH_SIZE,
+    BENCH_REVERSE,
+    BENCH_REVERSEK,
+    BENCH_SWAP,
+    BENCH_SORT,
+    BENCH_DEDUP,
+    BENCH_DM,
+    BENCH_ASCEND,
+    BENCH_DESCEND,
+    BENCH_MERGE,
+} bench_op_t;
+
+/**
+ * bench_ops - Operations bench can measure, named after their commands
+ * @name: name of the command running the operation
+ * @reuse: whether the fixture can be restored after the operation, rather
+ *         than built again
+ */
+static const struct {
+    const char *name;
+    bool reuse;
+} bench_ops[] = {
+    [BENCH_IH] = {"ih", true},         [BENCH_IT] = {"it", true},
+    [BENCH_RH] = {"rh", true},         [BENCH_RT] = {"rt", true},
+    [BENCH_SIZE] = {"size", true},     [BENCH_REVERSE] = {"reverse", true},
+    [BENCH_REVERSEK] = {"reverseK", true},
+    [BENCH_SWAP] = {"swap", true},     [BENCH_SORT] = {"sort", false},
+    [BENCH_DEDUP] = {"dedup", false},  [BENCH_DM] = {"dm", false},
+    [BENCH_ASCEND] = {"ascend", false}, [BENCH_DESCEND] = {"descend", false},
+    [BENCH_MERGE] = {"merge", false},
+};
+
+/**
+ * bench_fixture_t - Queues a benchmark runs an operation on
+ * @chain: the queues of @ctx, for merge
+ * @ctx: the queues, only the first one used but by merge
+ * @nr: number of queues of @ctx
+ * @strs: the strings of the queues, in order
+ * @size: number of strings in @strs
+ */
+typedef struct {
+    struct list_head chain;
+    queue_contex_t ctx[BENCH_MERGE_QUEUES];
+    int nr;
+    const char **strs;
+    int size;
+} bench_fixture_t;
+
+static void bench_teardown(bench_fixture_t *f)
+{
+    for (int i = 0; i < f->nr; i++)
+        q_free(f->ctx[i].q);
+    f->nr = 0;
+}
+
+/* Build the queues of f for op, and return whether they could be */
+static bool bench_setup(bench_fixture_t *f, bench_op_t op)
+{
+    f->nr = op == BENCH_MERGE ? BENCH_MERGE_QUEUES : 1;
+    INIT_LIST_HEAD(&f->chain);
+    for (int i = 0; i < f->nr; i++) {
+        int from = (long) f->size * i / f->nr;
+        int to = (long) f->size * (i + 1) / f->nr;
+        f->ctx[i].q = q_new();
+        f->ctx[i].size = to - from;
+        f->ctx[i].id = i;
+        list_add_tail(&f->ctx[i].chain, &f->chain);
+        if (!f->ctx[i].q ||
+            !q_insert_tail_bulk(f->ctx[i].q, f->strs + from, to - from)) {
+            f->nr = i + 1;
+            bench_teardown(f);
+            return false;
+        }
+
+        /* Merge and dedup expect sorted queues */
+        if (op == BENCH_MERGE || op == BENCH_DEDUP)
+            q_sort(f->ctx[i].q, descend);
+    }
+    return true;
+}
+
+/* Run op once on the queues of f, and return the nanoseconds it took */
+static uint64_t bench_run(bench_fixture_t *f, bench_op_t op)
+{
+    struct list_head *q = f->ctx[0].q;
+    char buf[MAXSTRING];
+    element_t *e = NULL;
+    uint64_t start = now_ns();
+
+    switch (op) {
+    case BENCH_IH:
+        q_insert_head(q, BENCH_STRING);
+        break;
+    case BENCH_IT:
+        q_insert_tail(q, BENCH_STRING);
+        break;
+    case BENCH_RH:
+        e = q_remove_head(q, buf, sizeof(buf));
+        break;
+    case BENCH_RT:
+        e = q_remove_tail(q, buf, sizeof(buf));
+        break;
+    case BENCH_SIZE:
+        q_size(q);
+        break;
+    case BENCH_REVERSE:
+        q_reverse(q);
+        break;
+    case BENCH_REVERSEK:
+        q_reverseK(q, BENCH_K);
+        break;
+    case BENCH_SWAP:
+        q_swap(q);
+        break;
+    case BENCH_SORT:
+        q_sort(q, descend);
+        break;
+    case BENCH_DEDUP:
+        q_delete_dup(q);
+        break;
+    case BENCH_DM:
+        q_delete_mid(q);
+        break;
+    case BENCH_ASCEND:
+        q_ascend(q);
+        break;
+    case BENCH_DESCEND:
+        q_descend(q);
+        break;
+    case BENCH_MERGE:
+        q_merge(&f->chain, descend);
+        break;
+    }
+    uint64_t ns = now_ns() - start;
+
+    /* Put back what the operation took away or added */
+    if (op == BENCH_IH || op == BENCH_IT) {
+        e = op == BENCH_IH ? q_remove_head(q, NULL, 0)
+                           : q_remove_tail(q, NULL, 0);
+    } else if (e) {
+        if (op == BENCH_RH)
+            q_insert_head(q, buf);
+        else
+            q_insert_tail(q, buf);
+    }
+    if (e)
+        q_release_element(e);
+    return ns;
+}
+
+static bool do_bench(int argc, char *argv[])
+{
+    int op, size, iters;
+    bool json = argc == 5 && !strcmp(argv[4], "json");
+    if (argc != 4 && !json) {
+        report(1, "%s needs 3 arguments, and json for JSON output", argv[0]);
+        return false;
+    }
+    int nr_ops = sizeof(bench_ops) / sizeof(bench_ops[0]);
+    for (op = 0; op < nr_ops; op++) {
+        if (!strcmp(argv[1], bench_ops[op].name))
+            break;
+    }
+    if (op == nr_ops) {
+        report(1, "Unknown operation '%s'", argv[1]);
+        return false;
+    }
+    if (!get_int(argv[2], &size) || size < 0) {
+        report(1, "Invalid queue size '%s'", argv[2]);
+        return false;
+    }
+    if (!get_int(argv[3], &iters) || iters < 1) {
+        report(1, "Invalid number of iterations '%s'", argv[3]);
+        return false;
+    }
+
+    /* Dedup gets every string twice, so that it has something to delete */
+    bench_fixture_t f = {.size = size, .nr = 0};
+    char (*bufs)[MAX_RANDSTR_LEN] = malloc((size + 1) * sizeof(*bufs));
+    f.strs = malloc((size + 1) * sizeof(char *));
+    if (!bufs || !f.strs) {
+        report(1, "INTERNAL ERROR.  Could not allocate space for benchmark");
+        free(bufs);
+        free(f.strs);
+        return false;
+    }
+    fill_rand_strings(bufs[0], size);
+    for (int i = 0; i < size; i++)
+        f.strs[i] = bufs[op == BENCH_DEDUP ? i / 2 : i];
+
+    /* Cost of reading the clock, taken off every measurement */
+    uint64_t clock_ns = UINT64_MAX;
+    for (int i = 0; i < 100; i++) {
+        uint64_t start = now_ns(), ns = now_ns() - start;
+        if (ns < clock_ns)
+            clock_ns = ns;
+    }
+
+    /* Warm up caches and branch predictors with the first tenth of the
+     * iterations, which are not counted
+     */
+    int warmup = iters / 10 + 1;
+    double mean = 0, m2 = 0;
+    uint64_t min_ns = UINT64_MAX, max_ns = 0;
+    bool ok = true;
+    error_check();
+    if (exception_setup(false)) {
+        for (int i = 0; ok && i < warmup + iters; i++) {
+            if (!f.nr || !bench_ops[op].reuse) {
+                bench_teardown(&f);
+                if (!bench_setup(&f, op)) {
+                    report(1, "ERROR: Could not build a queue of %d elements",
+                           size);
+                    ok = false;
+                    break;
+                }
+                if (op == BENCH_SORT && !q_sort_reserve(f.ctx[0].q))
+                    report(3, "Warning: Could not reserve memory for sort");
+            }
+
+            uint64_t ns = bench_run(&f, op);
+            if (op == BENCH_SORT)
+                q_sort_release();
+            ok = !error_check();
+            if (i < warmup)
+                continue;
+
+            /* Welford's running mean and variance */
+            ns = ns > clock_ns ? ns - clock_ns : 0;
+            int n = i - warmup + 1;
+            double delta = ns - mean;
+            mean += delta / n;
+            m2 += delta * (ns - mean);
+            if (ns < min_ns)
+                min_ns = ns;
+            if (ns > max_ns)
+                max_ns = ns;
+        }
+    } else {
+        ok = false;
+    }
+    exception_cancel();
+    bench_teardown(&f);
+    free(bufs);
+    free(f.strs);
+
+    if (!ok)
+        return false;
+    double stddev = iters > 1 ? sqrt(m2 / (iters - 1)) : 0;
+    double ops = mean > 0 ? 1e9 / mean : 0;
+    if (json)
+        report(1,
+               "{\"op\": \"%s\", \"size\": %d, \"iterations\": %d, "
+               "\"ns_per_op\": %.1f, \"ops_per_sec\": %.1f, "
+               "\"stddev_ns\": %.1f, \"min_ns\": %" PRIu64
+               ", \"max_ns\": %" PRIu64 ", \"clock_ns\": %" PRIu64 "}",
+               argv[1], size, iters, mean, ops, stddev, min_ns, max_ns,
+               clock_ns);
+    else
+        report(1,
+               "%s on %d elements, %d iterations: %.1f ns/op (stddev %.1f, "
+               "min %" PRIu64 ", max %" PRIu64 "), %.0f ops/s",
+               argv[1], size, iters, mean, stddev, min_ns, max_ns, ops);
+    return true;
+}
+
+/* Sites shown by allocstats unless told otherwise */
+#define ALLOCSTATS_TOP 10
+
+/* Print the name of the function holding address site, or the address */
+static void site_name(void *site, char *buf, size_t len)
+{
+    Dl_info info;
+    if (dladdr(site, &info) && info.dli_sname)
+        snprintf(buf, len, "%s+0x%tx", info.dli_sname,
+                 (char *) site - (char *) info.dli_saddr);
+    else if (dladdr(site, &info) && info.dli_fname)
+        snprintf(buf, len, "%s+0x%tx", info.dli_fname,
+                 (char *) site - (char *) info.dli_fbase);
+    else
+        snprintf(buf, len, "%p", site);
+}
+
+static bool do_allocstats(int argc, char *argv[])
+{
+    int top = ALLOCSTATS_TOP;
+    if (argc > 2 || (argc == 2 && (!get_int(argv[1], &top) || top < 0))) {
+        report(1, "%s takes an optional number of sites", argv[0]);
+        return false;
+    }
+
+    /* All sites are needed for the live bytes, only the top ones shown */
+    size_t nr_sites = alloc_sites(NULL, 0);
+    alloc_site_t *sites = malloc((nr_sites + 1) * sizeof(alloc_site_t));
+    if (!sites) {
+        report(1, "INTERNAL ERROR.  Could not allocate space for statistics");
+        return false;
+    }
+    nr_sites = alloc_sites(sites, nr_sites);
+
+    /* Blocks are all made by the queue code, qtest using the real malloc */
+    size_t blocks = allocation_check(), payload = 0, elements = 0;
+    for (size_t i = 0; i < nr_sites; i++)
+        payload += sites[i].live_bytes;
+    size_t overhead = alloc_overhead() * blocks;
+    queue_contex_t *ctx;
+    list_for_each_entry (ctx, &chain.head, chain)
+        elements += ctx->size;
+
+    report(1, "%zu blocks live, %zu bytes added by the harness (%zu per block)",
+           blocks, overhead, alloc_overhead());
+    if (elements)
+        report(1, "%zu elements: %.1f bytes each, %.1f of them the harness's",
+               elements, (double) (payload + overhead) / elements,
+               (double) overhead / elements);
+
+    if (nr_sites)
+        report(1, "%10s %12s %10s %12s  %s", "live", "live bytes", "count",
+               "bytes", "site");
+    for (size_t i = 0; i < nr_sites && i < (size_t) top; i++) {
+        char name[128];
+        site_name(sites[i].site, name, sizeof(name));
+        report(1, "%10zu %12zu %10zu %12zu  %s", sites[i].live,
+               sites[i].live_bytes, sites[i].count, sites[i].bytes, name);
+    }
+    if (nr_sites > (size_t) top)
+        report(1, "(%zu more sites)", nr_sites - top);
+    free(sites);
+
+    size_t hist[ALLOC_HIST_BUCKETS];
+    alloc_size_histogram(hist);
+    report(1, "Allocations by size:");
+    for (int k = 0; k < ALLOC_HIST_BUCKETS; k++) {
+        if (!hist[k])
+            continue;
+        if (k == 0)
+            report(1, "%21s %10zu", "0", hist[k]);
+        else
+            report(1, "%10zu-%-10zu %10zu", (size_t) 1 << (k - 1),
+                   (k == 64 ? SIZE_MAX : ((size_t) 1 << k) - 1), hist[k]);
+    }
+    return true;
+}
+
+static bool do_stats(int argc, char *argv[])
+{
+    if (argc == 2 && !strcmp(argv[1], "reset")) {
+        cmd_stats_reset();
+        return true;
+    }
+    if (argc != 1) {
+        report(1, "%s takes no arguments, or reset", argv[0]);
+        return false;
+    }
+
+    if (!cmd_stats) {
+        report(1, "No queue operation timed yet");
+        return true;
+    }
+    report(1, "%-10s %8s %11s %11s %11s %11s %11s %11s", "cmd (us)", "count",
+           "mean", "p50", "p90", "p99", "p99.9", "max");
+    for (cmd_stats_t *st = cmd_stats; st; st = st->next) {
+        const histogram_t *h = &st->hist;
+        report(1,
+               "%-10s %8" PRIu64 " %11.3f %11.3f %11.3f %11.3f %11.3f %11.3f",
+               st->name, h->count, h->sum / 1e3 / h->count,
+               hist_percentile(h, 50) / 1e3, hist_percentile(h, 90) / 1e3,
+               hist_percentile(h, 99) / 1e3, hist_percentile(h, 99.9) / 1e3,
+               h->max / 1e3);
+    }
+    return true;
+}
+
 static bool do_show(int argc, char *argv[])
 {
     if (argc != 1) {
@@ -1012,6 +1822,20 @@ static bool do_next(int argc, char *argv[])
     return q_show(0);
 }
 
+static void seed_setter(int oldval)
+{
+    prng_seed(&rng, (uint64_t) seed);
+    set_fail_seed(seed);
+}
+
+static void compact_setter(int oldval)
+{
+    if (!set_compact_mode(compact)) {
+        report(1, "Cannot change the layout of blocks while any is allocated");
+        compact = oldval;
+    }
+}
+
 static void console_init()
 {
     ADD_COMMAND(new, "Create new queue", "");
@@ -1026,20 +1850,25 @@ static void console_init()
                 "Insert string str at tail of queue n times. Generate random "
                 "string(s) if str equals RAND. (default: n == 1)",
                 "str [n]");
-    ADD_COMMAND(
-        rh,
-        "Remove from head of queue. Optionally compare to expected value str",
-        "[str]");
-    ADD_COMMAND(
-        rt,
-        "Remove from tail of queue. Optionally compare to expected value str",
-        "[str]");
+    ADD_COMMAND(rh,
+                "Remove from head of queue n times. Optionally compare to "
+                "expected value str, any value if str equals * (default: n "
+                "== 1)",
+                "[str [n]]");
+    ADD_COMMAND(rt,
+                "Remove from tail of queue n times. Optionally compare to "
+                "expected value str, any value if str equals * (default: n "
+                "== 1)",
+                "[str [n]]");
     ADD_COMMAND(reverse, "Reverse queue", "");
     ADD_COMMAND(sort, "Sort queue in ascending/descening order", "");
     ADD_COMMAND(size, "Compute queue size n times (default: n == 1)", "[n]");
     ADD_COMMAND(show, "Show queue contents", "");
     ADD_COMMAND(dm, "Delete middle node in queue", "");
-    ADD_COMMAND(dedup, "Delete all nodes that have duplicate string", "");
+    ADD_COMMAND(dedup,
+                "Delete all nodes that have duplicate string, anywhere in "
+                "the queue with 'hash'",
+                "[hash]");
     ADD_COMMAND(merge, "Merge all the queues into one sorted queue", "");
     ADD_COMMAND(swap, "Swap every two adjacent nodes in queue", "");
     ADD_COMMAND(ascend,
@@ -1052,14 +1881,49 @@ static void console_init()
                 "");
     ADD_COMMAND(reverseK, "Reverse the nodes of the queue 'K' at a time",
                 "[K]");
+    ADD_COMMAND(stress,
+                "Move n strings through a concurrent queue, from p producer "
+                "to c consumer threads",
+                "p c n");
+    ADD_COMMAND(bench,
+                "Time op, one of ih, it, rh, rt, size, reverse, reverseK, "
+                "swap, sort, dedup, dm, ascend, descend and merge, on a queue "
+                "of n elements",
+                "op n iterations [json]");
+    ADD_COMMAND(stats,
+                "Show the latencies of the queue operations of each command, "
+                "or forget them",
+                "[reset]");
+    ADD_COMMAND(allocstats,
+                "Show the call sites allocating the most memory, and the cost "
+                "of an element",
+                "[n]");
     add_param("length", &string_length, "Maximum length of displayed string",
               NULL);
     add_param("malloc", &fail_probability, "Malloc failure probability percent",
               NULL);
+    add_param("seed", &seed,
+              "Seed of the random strings and malloc failures, to repeat them",
+              seed_setter);
+    add_param("compact", &compact,
+              "Keep what the harness knows about blocks apart from them",
+              compact_setter);
+    add_param("fill", &fill_sample,
+              "Fill one block in n with junk on malloc and free (0: none)",
+              NULL);
+    add_param("timelimit_ms", &time_limit_ms,
+              "Time limit of each queue operation in milliseconds (0: none)",
+              NULL);
     add_param("fail", &fail_limit,
               "Number of times allow queue operations to return false", NULL);
     add_param("descend", &descend,
               "Sort and merge queue in ascending/descending order", NULL);
+    add_param_choices("sortalg", &sort_alg, sort_algs,
+                      "Sort algorithm: tim, merge or radix", NULL);
+    add_param("threads", &sort_threads, "Number of threads used by sort",
+              NULL);
+    add_param("intern", &intern_strings,
+              "Share the storage of equal long strings", NULL);
 }
 
 /* Signal handlers */
@@ -1076,6 +1940,8 @@ static void sigsegv_handler(int sig)
 
 static void sigalrm_handler(int sig)
 {
+    if (!time_limit_exceeded())
+        return;
     trigger_exception(
         "Time limit exceeded.  Either you are in an infinite loop, or your "
         "code is too inefficient");
@@ -1092,8 +1958,6 @@ static void q_init()
 static bool q_quit(int argc, char *argv[])
 {
     report(3, "Freeing queue");
-    if (current && current->size > BIG_LIST_SIZE)
-        set_cautious_mode(false);
 
     if (exception_setup(true)) {
         struct list_head *cur = chain.head.next;
@@ -1107,7 +1971,7 @@ static bool q_quit(int argc, char *argv[])
     }
 
     exception_cancel();
-    set_cautious_mode(true);
+    cmd_stats_reset();
 
     size_t bcnt = allocation_check();
     if (bcnt > 0) {
@@ -1228,10 +2092,14 @@ int main(int argc, char *argv[])
         }
     }
 
-    /* A better seed can be obtained by combining getpid() and its parent ID
-     * with the Unix time.
+    /* The seed is shown by option, for the run to be repeated. Without
+     * getrandom(), a seed can still be had from getpid() and its parent ID
+     * combined with the time.
      */
-    srand(os_random(getpid() ^ getppid()));
+    if (randombytes((uint8_t *) &seed, sizeof(seed)))
+        seed = os_random(getpid() ^ getppid());
+    prng_seed(&rng, (uint64_t) seed);
+    set_fail_seed(seed);
 
     q_init();
     init_cmd();
@@ -3,6 +3,8 @@
 #include <string.h>
 
 #include "queue.h"
+#include "sort.h"
+#include "strhash.h"
 
 /* Notice: sometimes, Cppcheck would find the potential NULL pointer bugs,
  * but some of them cannot occur. You can suppress them by adding the
@@ -11,110 +13,388 @@
  */
 
 
+/* Nodes are carved from a per-queue pool in slots of this size. Strings
+ * short enough to fit in the rest of the slot are stored inside the node,
+ * longer ones get a separate allocation.
+ */
+#define ELEMENT_SLOT_SIZE 64
+#define ELEMENT_INLINE_LEN (ELEMENT_SLOT_SIZE - sizeof(element_t) - 1)
+
+/**
+ * queue_t - Header of a queue, as returned by q_new()
+ * @head: head of the list of elements, handed out to the callers
+ * @size: number of elements in the queue
+ * @reversed: whether the logical order is the reverse of the list order
+ * @sorted_asc: whether the queue is known to be in ascending order
+ * @sorted_desc: whether the queue is known to be in descending order
+ * @pool: pool holding every element of this queue
+ * @ext: number of elements whose string is allocated outside of the node
+ *
+ * Every q_* function that links or unlinks elements keeps @size up to date,
+ * which makes q_size() a constant-time operation.
+ *
+ * q_reverse() only flips @reversed. Operations working at either end follow
+ * it, the ones needing the list in logical order call materialize() first.
+ *
+ * The sorted flags are kept up to date on insertion, which costs a single
+ * comparison, and survive any removal. Operations which reorder elements
+ * clear them, unless all elements are equal.
+ */
+typedef struct {
+    struct list_head head;
+    size_t size;
+    bool reversed;
+    bool sorted_asc, sorted_desc;
+    pool_t pool;
+    size_t ext;
+} queue_t;
+
+static inline queue_t *to_queue(struct list_head *head)
+{
+    return container_of(head, queue_t, head);
+}
+
+int intern_strings = 0;
+
 /* Create an empty queue */
 struct list_head *q_new()
 {
-    struct list_head *head = malloc(sizeof(struct list_head));
-    if (!head) {
-        free(head);
+    queue_t *q = malloc(sizeof(queue_t));
+    if (!q)
         return NULL;
-    } else {
-        head->prev = head;
-        head->next = head;
-        return head;
-    }
+
+    INIT_LIST_HEAD(&q->head);
+    q->size = 0;
+    q->reversed = false;
+    q->sorted_asc = q->sorted_desc = true;
+    pool_init(&q->pool, ELEMENT_SLOT_SIZE);
+    q->ext = 0;
+    return &q->head;
 }
 
 /* Free all storage used by queue */
 void q_free(struct list_head *head)
 {
-    element_t *entry, *safe;
-    if (!head || list_empty(head)) {
-        free(head);
+    if (!head)
         return;
+
+    queue_t *q = to_queue(head);
+    if (q->ext) {
+        element_t *entry;
+        list_for_each_entry (entry, head, list) {
+            if (entry->value != entry->data)
+                strpool_put(entry->value);
+        }
     }
-    list_for_each_entry_safe (entry, safe, head, list) {
-        q_release_element(entry);
-    }
-    free(head);
-    return;
+    /* Nodes go away together with their slabs */
+    pool_destroy(&q->pool);
+    free(q);
 }
 
-/* Insert an element at head of queue */
-bool q_insert_head(struct list_head *head, char *s)
+/* Allocate an element from the pool of q holding a copy of s, of length len */
+static element_t *element_new(queue_t *q, const char *s, size_t len)
 {
-    if (__glibc_unlikely(!head || !s))
-        return false;
-    element_t *insert = malloc(sizeof(element_t));
-    if (!insert) {
-        free(insert);
-        return false;
+    element_t *e = pool_alloc(&q->pool);
+    if (!e)
+        return NULL;
+
+    if (len <= ELEMENT_INLINE_LEN) {
+        e->value = e->data;
+        memcpy(e->value, s, len);
+        e->value[len] = '\0';
+    } else {
+        e->value = strpool_get(s, len, intern_strings);
+        if (!e->value) {
+            pool_free(e);
+            return NULL;
+        }
+        q->ext++;
     }
+    e->len = len;
+    e->key = element_key(e->value, len);
+    return e;
+}
 
-    insert->value = (char *) malloc((strlen(s) + 1) * sizeof(char));
-    if (!insert->value) {
-        free(insert->value);
-        free(insert);
+/* Unlink an element from q, which no longer accounts for its storage */
+static inline void element_unlink(queue_t *q, element_t *e)
+{
+    list_del(&e->list);
+    q->size--;
+    if (e->value != e->data)
+        q->ext--;
+    if (q->size <= 1)
+        q->sorted_asc = q->sorted_desc = true;
+}
+
+/* Update what is known of the order of q, as e is added next to the element
+ * at its head or tail, NULL for an empty queue
+ */
+static inline void track_insert(queue_t *q,
+                                const element_t *end,
+                                const element_t *e,
+                                bool tail)
+{
+    if (!end || !(q->sorted_asc || q->sorted_desc))
+        return;
+    int cmp = tail ? element_cmp(end, e) : element_cmp(e, end);
+    q->sorted_asc = q->sorted_asc && cmp <= 0;
+    q->sorted_desc = q->sorted_desc && cmp >= 0;
+}
+
+/* Forget the order of q, after its elements have been reordered */
+static inline void track_reorder(queue_t *q)
+{
+    /* Equal elements are sorted whatever their order */
+    if (!(q->sorted_asc && q->sorted_desc))
+        q->sorted_asc = q->sorted_desc = false;
+}
+
+/* Return the element at the head or tail of q, NULL if q is empty */
+static inline element_t *queue_end(queue_t *q, bool tail)
+{
+    if (list_empty(&q->head))
+        return NULL;
+    struct list_head *node = tail != q->reversed ? q->head.prev : q->head.next;
+    return list_entry(node, element_t, list);
+}
+
+/* Unlink an element from q and release it */
+static inline void element_delete(queue_t *q, element_t *e)
+{
+    element_unlink(q, e);
+    q_release_element(e);
+}
+
+bool q_reserve(struct list_head *head, size_t n)
+{
+    if (!head)
         return false;
+    return pool_reserve(&to_queue(head)->pool, n);
+}
+
+/* Reverse the nodes of a list, which does not have to be a queue */
+static void list_reverse(struct list_head *head)
+{
+    /* Swap the links of every node, the head included */
+    struct list_head *node = head;
+    do {
+        struct list_head *next = node->next;
+        node->next = node->prev;
+        node->prev = next;
+        node = next;
+    } while (node != head);
+}
+
+/* Make the list order of q the logical one */
+static inline void materialize(queue_t *q)
+{
+    if (q->reversed) {
+        list_reverse(&q->head);
+        q->reversed = false;
     }
-    strncpy(insert->value, s, strlen(s));
-    *(insert->value + strlen(s)) = '\0';
-    list_add(&insert->list, head);
+}
 
+/* Insert an element at the head or tail of queue */
+static bool insert(struct list_head *head, const char *s, bool tail)
+{
+    if (__glibc_unlikely(!head || !s))
+        return false;
+    queue_t *q = to_queue(head);
+    element_t *insert = element_new(q, s, strlen(s));
+    if (!insert)
+        return false;
+    track_insert(q, queue_end(q, tail), insert, tail);
+    if (tail != q->reversed)
+        list_add_tail(&insert->list, head);
+    else
+        list_add(&insert->list, head);
+    q->size++;
     return true;
 }
 
-/* Insert an element at tail of queue */
+/* Insert an element at head of queue */
+bool q_insert_head(struct list_head *head, char *s)
+{
+    return insert(head, s, false);
+}
 
+/* Insert an element at tail of queue */
 bool q_insert_tail(struct list_head *head, char *s)
 {
-    if (__glibc_unlikely(!head || !s))
-        return false;
-    element_t *insert = malloc(sizeof(element_t));
-    if (!insert) {
+    return insert(head, s, true);
+}
+
+/* Insert n elements, holding strs[i] or copies of s when strs is NULL, at the
+ * head or tail of the queue. The new elements are linked on a list of their
+ * own first, so that the queue is left untouched if any allocation fails.
+ */
+static bool insert_bulk(struct list_head *head,
+                        const char **strs,
+                        const char *s,
+                        size_t n,
+                        bool tail)
+{
+    if (!head || (!strs && !s))
         return false;
-    }
-    insert->value = malloc((strlen(s) + 1) * sizeof(char));
-    if (!insert->value) {
-        free(insert->value);
-        free(insert);
+
+    queue_t *q = to_queue(head);
+    if (!pool_reserve(&q->pool, n))
         return false;
+
+    LIST_HEAD(batch);
+    bool back = tail != q->reversed;
+    bool sorted_asc = q->sorted_asc, sorted_desc = q->sorted_desc;
+    size_t len = s ? strlen(s) : 0, ext = q->ext;
+    element_t *end = queue_end(q, tail);
+    for (size_t i = 0; i < n; i++) {
+        const char *str = strs ? strs[i] : s;
+        element_t *e =
+            str ? element_new(q, str, strs ? strlen(str) : len) : NULL;
+        if (!e) {
+            element_t *safe;
+            list_for_each_entry_safe (e, safe, &batch, list)
+                q_release_element(e);
+            q->ext = ext;
+            q->sorted_asc = sorted_asc;
+            q->sorted_desc = sorted_desc;
+            return false;
+        }
+        track_insert(q, end, e, tail);
+        end = e;
+        /* Same order as inserting the strings one at a time */
+        if (back)
+            list_add_tail(&e->list, &batch);
+        else
+            list_add(&e->list, &batch);
     }
-    strncpy(insert->value, s, strlen(s));
-    *(insert->value + strlen(s)) = '\0';
-    list_add_tail(&insert->list, head);
+
+    if (back)
+        list_splice_tail(&batch, head);
+    else
+        list_splice(&batch, head);
+    q->size += n;
     return true;
 }
 
+bool q_insert_head_bulk(struct list_head *head, const char **strs, size_t n)
+{
+    return insert_bulk(head, strs, NULL, n, false);
+}
+
+bool q_insert_tail_bulk(struct list_head *head, const char **strs, size_t n)
+{
+    return insert_bulk(head, strs, NULL, n, true);
+}
+
+bool q_insert_head_repeat(struct list_head *head, const char *s, size_t n)
+{
+    return insert_bulk(head, NULL, s, n, false);
+}
+
+bool q_insert_tail_repeat(struct list_head *head, const char *s, size_t n)
+{
+    return insert_bulk(head, NULL, s, n, true);
+}
+
+
+/* Copy the string of e into sp, truncated to bufsize - 1 characters. Only
+ * the string and its terminator are written.
+ */
+static inline void element_copy(const element_t *e, char *sp, size_t bufsize)
+{
+    if (!sp || !bufsize)
+        return;
+    size_t n = e->len < bufsize - 1 ? e->len : bufsize - 1;
+    memcpy(sp, e->value, n);
+    sp[n] = '\0';
+}
+
+/* Remove an element from the head or tail of queue */
+static element_t *remove_end(struct list_head *head,
+                             char *sp,
+                             size_t bufsize,
+                             bool tail)
+{
+    if (!head || list_empty(head))
+        return NULL;
+    queue_t *q = to_queue(head);
+    element_t *e = queue_end(q, tail);
+    element_unlink(q, e);
+    element_copy(e, sp, bufsize);
+    return e;
+}
 
 /* Remove an element from head of queue */
 element_t *q_remove_head(struct list_head *head, char *sp, size_t bufsize)
 {
-    if (!head || list_empty(head)) {
-        return NULL;
-    }
-    element_t *remove_element = list_first_entry(head, element_t, list);
-    list_del(head->next);
-    if (sp) {
-        strncpy(sp, remove_element->value, bufsize - 1);
-        *(sp + bufsize - 1) = '\0';
-    }
-    return remove_element;
+    return remove_end(head, sp, bufsize, false);
 }
 
 /* Remove an element from tail of queue */
 element_t *q_remove_tail(struct list_head *head, char *sp, size_t bufsize)
 {
-    if (!head || list_empty(head)) {
+    return remove_end(head, sp, bufsize, true);
+}
+
+/* Remove an element from head of queue, handing out its string in place */
+element_t *q_remove_head_nocopy(struct list_head *head,
+                                const char **sp,
+                                size_t *len)
+{
+    element_t *e = q_remove_head(head, NULL, 0);
+    if (e && sp)
+        *sp = e->value;
+    if (e && len)
+        *len = e->len;
+    return e;
+}
+
+/* Remove an element from tail of queue, handing out its string in place */
+element_t *q_remove_tail_nocopy(struct list_head *head,
+                                const char **sp,
+                                size_t *len)
+{
+    element_t *e = q_remove_tail(head, NULL, 0);
+    if (e && sp)
+        *sp = e->value;
+    if (e && len)
+        *len = e->len;
+    return e;
+}
+
+static inline element_t *iter_entry(const q_iter_t *it)
+{
+    return it->node == it->head ? NULL : list_entry(it->node, element_t, list);
+}
+
+element_t *q_iter_first(struct list_head *head, q_iter_t *it)
+{
+    if (!head)
         return NULL;
-    }
-    element_t *remove_element = list_last_entry(head, element_t, list);
-    list_del(head->prev);
-    if (sp) {
-        strncpy(sp, remove_element->value, bufsize - 1);
-        *(sp + bufsize - 1) = '\0';
-    }
-    return remove_element;
+    it->head = head;
+    it->node = to_queue(head)->reversed ? head->prev : head->next;
+    return iter_entry(it);
+}
+
+element_t *q_iter_last(struct list_head *head, q_iter_t *it)
+{
+    if (!head)
+        return NULL;
+    it->head = head;
+    it->node = to_queue(head)->reversed ? head->next : head->prev;
+    return iter_entry(it);
+}
+
+element_t *q_iter_next(q_iter_t *it)
+{
+    it->node = to_queue(it->head)->reversed ? it->node->prev : it->node->next;
+    return iter_entry(it);
+}
+
+element_t *q_iter_prev(q_iter_t *it)
+{
+    it->node = to_queue(it->head)->reversed ? it->node->next : it->node->prev;
+    return iter_entry(it);
 }
 
 /* Return number of elements in queue */
@@ -122,12 +402,7 @@ int q_size(struct list_head *head)
 {
     if (!head)
         return 0;
-    struct list_head *cur;
-    int count = 0;
-    list_for_each (cur, head) {
-        count++;
-    }
-    return count;
+    return to_queue(head)->size;
 }
 
 /* Delete the middle node in queue */
@@ -139,12 +414,12 @@ bool q_delete_mid(struct list_head *head)
     struct list_head *right = head->next;
     while (true) {
         if (left == right) {
-            list_del(right);
-            q_release_element(list_entry(right, element_t, list));
+            element_delete(to_queue(head), list_entry(right, element_t, list));
             break;
         } else if (right->prev == left) {
-            list_del(left);
-            q_release_element(list_entry(left, element_t, list));
+            /* Of the two middle nodes, the one coming first */
+            struct list_head *mid = to_queue(head)->reversed ? right : left;
+            element_delete(to_queue(head), list_entry(mid, element_t, list));
             break;
         }
         right = right->next;
@@ -157,48 +432,71 @@ bool q_delete_mid(struct list_head *head)
 /* Delete all nodes that have duplicate string */
 bool q_delete_dup(struct list_head *head)
 {
-    if (!head || list_empty(head) || list_is_singular(head))
+    if (!head)
         return false;
 
-    struct list_head *cur, *safe, *first, *last, *temp;
-    cur = first = last = head->next;
-    safe = cur->next;
+    queue_t *q = to_queue(head);
+    element_t *e, *safe;
+    bool dup = false;
+    list_for_each_entry_safe (e, safe, head, list) {
+        bool next_dup = &safe->list != head && !element_cmp(e, safe);
+        if (dup || next_dup)
+            element_delete(q, e);
+        dup = next_dup;
+    }
+    return true;
+}
 
-    while (safe != head) {
-        if (strcmp(list_entry(cur, element_t, list)->value,
-                   list_entry(safe, element_t, list)->value) == 0) {
-            last = safe;
-        } else {
-            if (first != last) {
-                while (first != last) {
-                    temp = first;
-                    first = first->next;
-                    list_del(temp);
-                    q_release_element(list_entry(temp, element_t, list));
-                }
-                temp = first;
-                first = last = last->next;
-                list_del(temp);
-                q_release_element(list_entry(temp, element_t, list));
-            } else {
-                cur = cur->next;
-            }
+/**
+ * dedup_slot_t - Slot of the table used by q_delete_dup_hash()
+ * @hash: hash of the string of @e
+ * @e: first element holding the string, NULL for an empty slot
+ * @dup: whether the string has been seen again after @e
+ */
+typedef struct {
+    uint64_t hash;
+    element_t *e;
+    bool dup;
+} dedup_slot_t;
+
+/* Delete all nodes whose string appears more than once, in any order */
+bool q_delete_dup_hash(struct list_head *head)
+{
+    if (!head)
+        return false;
 
-            cur = first;
-            first = last = cur;
-            safe = cur->next;
+    /* Open addressing with linear probing, kept at most half full */
+    queue_t *q = to_queue(head);
+    size_t cap = 16;
+    while (cap < 2 * q->size)
+        cap <<= 1;
+    dedup_slot_t *table = malloc(cap * sizeof(dedup_slot_t));
+    if (!table)
+        return false;
+    memset(table, 0, cap * sizeof(dedup_slot_t));
+
+    /* Later copies go right away, first ones once the whole queue is seen */
+    element_t *e, *safe;
+    list_for_each_entry_safe (e, safe, head, list) {
+        uint64_t hash = strhash(e->value, e->len, 0);
+        size_t i = hash & (cap - 1);
+        while (table[i].e &&
+               (table[i].hash != hash || element_cmp(table[i].e, e)))
+            i = (i + 1) & (cap - 1);
+
+        if (table[i].e) {
+            table[i].dup = true;
+            element_delete(q, e);
+        } else {
+            table[i] = (dedup_slot_t){.hash = hash, .e = e, .dup = false};
         }
     }
 
-    if (first != last) {
-        while (first != last->next) {
-            temp = first;
-            first = first->next;
-            list_del(temp);
-            q_release_element(list_entry(temp, element_t, list));
-        }
+    for (size_t i = 0; i < cap; i++) {
+        if (table[i].dup)
+            element_delete(q, table[i].e);
     }
-
+    free(table);
     return true;
 }
 
@@ -209,6 +507,8 @@ void q_swap(struct list_head *head)
     // https://leetcode.com/problems/swap-nodes-in-pairs/
     if (!head || list_empty(head))
         return;
+    materialize(to_queue(head));
+    track_reorder(to_queue(head));
     struct list_head *cur;
     for (cur = head->next; cur != head && cur != head->prev; cur = cur->next) {
         struct list_head *next = cur->next;
@@ -221,19 +521,13 @@ void q_swap(struct list_head *head)
 /* Reverse elements in queue */
 void q_reverse(struct list_head *head)
 {
-    if (!head || list_empty(head) || list_is_singular(head))
+    if (!head)
         return;
-    struct list_head *left = head->prev;
-    struct list_head *right = head->next;
-    while (left != right && right->next != left) {
-        struct list_head *temp_l = left->prev;
-        struct list_head *temp_r = right->next;
-        list_move(left, right);
-        list_move(right, temp_l);
-        right = temp_r;
-        left = temp_l;
-    }
-    return;
+    queue_t *q = to_queue(head);
+    q->reversed ^= true;
+    bool sorted_asc = q->sorted_asc;
+    q->sorted_asc = q->sorted_desc;
+    q->sorted_desc = sorted_asc;
 }
 
 
@@ -242,6 +536,9 @@ void q_reverseK(struct list_head *head, int k)
 {
     if (!head || list_empty(head) || k == 0)
         return;
+    materialize(to_queue(head));
+    if (k > 1 && q_size(head) >= k)
+        track_reorder(to_queue(head));
     struct list_head *cur_tail = head->next;
     int rev_times = q_size(head) / k;
     LIST_HEAD(tmp);
@@ -250,7 +547,7 @@ void q_reverseK(struct list_head *head, int k)
         for (int j = 0; j < k; ++j)
             cur_tail = cur_tail->next;
         list_cut_position(&tmp, head, cur_tail->prev);
-        q_reverse(&tmp);
+        list_reverse(&tmp);
         list_splice_tail_init(&tmp, &result);
     }
     list_splice_init(&result, head);
@@ -258,116 +555,42 @@ void q_reverseK(struct list_head *head, int k)
     // https://leetcode.com/problems/reverse-nodes-in-k-group/
 }
 
-struct list_head *mergeTwoList_a(struct list_head *l1, struct list_head *l2)
+/* Sort elements of queue in ascending/descending order */
+void q_sort(struct list_head *head, bool descend)
 {
-    struct list_head *head = NULL;
-    if (strcmp(list_entry(l1, element_t, list)->value,
-               list_entry(l2, element_t, list)->value) <= 0) {
-        head = l1;
-        l1 = l1->next;
-    } else {
-        struct list_head *temp = l1;
-        l1 = l2;
-        l2 = temp;
-        head = l1;
-        l1 = l1->next;
-    }
-    list_del_init(head);
-    while (l1->next != head && l2->next != head) {
-        if (strcmp(list_entry(l1, element_t, list)->value,
-                   list_entry(l2, element_t, list)->value) <= 0) {
-            l1 = l1->next;
-            list_move_tail(l1->prev, head);
-
-        } else {
-            l2 = l2->next;
-            list_move_tail(l2->prev, head);
-        }
-    }
-    if (l1->next != head) {
-        while (l1->next != head) {
-            l1 = l1->next;
-            list_move_tail(l1->prev, head);
-        }
-    } else {
-        while (l2->next != head) {
-            l2 = l2->next;
-            list_move_tail(l2->prev, head);
-        }
+    if (!head)
+        return;
+    queue_t *q = to_queue(head);
+    if (descend ? q->sorted_desc : q->sorted_asc) {
+        sort_skipped();
+        return;
     }
-    return head;
+    materialize(q);
+    element_sort(head, q->size, descend);
+    q->sorted_asc = !descend;
+    q->sorted_desc = descend;
 }
 
-struct list_head *mergeTwoList_d(struct list_head *l1, struct list_head *l2)
+bool q_is_sorted(struct list_head *head, bool descend)
 {
-    struct list_head *head = NULL;
-    if (strcmp(list_entry(l1, element_t, list)->value,
-               list_entry(l2, element_t, list)->value) >= 0) {
-        head = l1;
-        l1 = l1->next;
-    } else {
-        struct list_head *temp = l1;
-        l1 = l2;
-        l2 = temp;
-        head = l1;
-        l1 = l1->next;
-    }
-    list_del_init(head);
-    while (l1->next != head && l2->next != head) {
-        if (strcmp(list_entry(l1, element_t, list)->value,
-                   list_entry(l2, element_t, list)->value) >= 0) {
-            l1 = l1->next;
-            list_move_tail(l1->prev, head);
-
-        } else {
-            l2 = l2->next;
-            list_move_tail(l2->prev, head);
-        }
-    }
-    if (l1->next != head) {
-        while (l1->next != head) {
-            l1 = l1->next;
-            list_move_tail(l1->prev, head);
-        }
-    } else {
-        while (l2->next != head) {
-            l2 = l2->next;
-            list_move_tail(l2->prev, head);
-        }
-    }
-    return head;
-}
-
-
-/* Sort elements of queue in ascending/descending order */
-// struct list_head *mergeTwoList(struct list_head *list1,
-//                                struct list_head *list2);
+    if (!head)
+        return false;
 
-void q_sort(struct list_head *head, bool descend)
-{
-    if (!head || list_empty(head) || list_is_singular(head))
-        return;
-    struct list_head *list[1000000];
-    struct list_head *cur, *safe;
-    int count = 0;
-    int size = q_size(head);
-    list_for_each_safe (cur, safe, head) {
-        list[count] = cur;
-        list_del_init(list[count++]);
-    }
-    INIT_LIST_HEAD(head);
-    for (int interval = 1; interval < size; interval *= 2) {
-        for (int i = 0; i + interval < size; i += interval * 2) {
-            if (descend) {
-                list[i] = mergeTwoList_d(list[i], list[i + interval]);
-            } else {
-                list[i] = mergeTwoList_a(list[i], list[i + interval]);
-            }
+    queue_t *q = to_queue(head);
+    if (!(descend ? q->sorted_desc : q->sorted_asc)) {
+        /* Find out once, the flags being kept up to date from then on */
+        q_iter_t it;
+        element_t *e = q_iter_first(head, &it), *next;
+        bool asc = true, desc = true;
+        for (; e && (next = q_iter_next(&it)) && (asc || desc); e = next) {
+            int cmp = element_cmp(e, next);
+            asc = asc && cmp <= 0;
+            desc = desc && cmp >= 0;
         }
+        q->sorted_asc = asc;
+        q->sorted_desc = desc;
     }
-    // NIT_LIST_HEAD(head);
-    list_add_tail(head, list[0]);
-    return;
+    return descend ? q->sorted_desc : q->sorted_asc;
 }
 
 
@@ -377,43 +600,78 @@ int q_ascend(struct list_head *head)
 {
     if (!head || list_empty(head))
         return 0;
-    struct list_head *slow = head->next;
-    element_t *slow_node = list_entry(slow, element_t, list);
-    while (slow->next != head) {
-        element_t *fast_node = list_entry(slow->next, element_t, list);
-        if (strcmp(slow_node->value, fast_node->value) > 0) {
-            list_del(&fast_node->list);
-            q_release_element(fast_node);
-        } else {
-            slow = slow->next;
-        }
+    if (to_queue(head)->sorted_asc)
+        return q_size(head);
+
+    /* Walk from the tail, keeping the least value seen so far */
+    materialize(to_queue(head));
+    element_t *min = list_last_entry(head, element_t, list);
+    while (min->list.prev != head) {
+        element_t *prev = list_entry(min->list.prev, element_t, list);
+        if (element_cmp(prev, min) > 0)
+            element_delete(to_queue(head), prev);
+        else
+            min = prev;
     }
+    to_queue(head)->sorted_asc = true;
     return q_size(head);
 }
 
-
-
 /* Remove every node which has a node with a strictly greater value anywhere to
  * the right side of it */
-
 int q_descend(struct list_head *head)
 {
     if (!head || list_empty(head))
         return 0;
-    struct list_head *slow = head->prev;
-    element_t *slow_node = list_entry(slow, element_t, list);
-    while (slow->prev != head) {
-        element_t *fast_node = list_entry(slow->prev, element_t, list);
-        if (strcmp(slow_node->value, fast_node->value) < 0) {
-            list_del(&fast_node->list);
-            q_release_element(fast_node);
-        } else {
-            slow = slow->prev;
-        }
+    if (to_queue(head)->sorted_desc)
+        return q_size(head);
+
+    /* Walk from the tail, keeping the greatest value seen so far */
+    materialize(to_queue(head));
+    element_t *max = list_last_entry(head, element_t, list);
+    while (max->list.prev != head) {
+        element_t *prev = list_entry(max->list.prev, element_t, list);
+        if (element_cmp(prev, max) < 0)
+            element_delete(to_queue(head), prev);
+        else
+            max = prev;
     }
+    to_queue(head)->sorted_desc = true;
     return q_size(head);
 }
 
+/* Make dst the owner of every element of src */
+static void queue_adopt(queue_t *dst, queue_t *src)
+{
+    dst->size += src->size;
+    src->size = 0;
+    pool_merge(&dst->pool, &src->pool);
+    dst->ext += src->ext;
+    src->ext = 0;
+    src->sorted_asc = src->sorted_desc = true;
+}
+
+/* Merge the k sorted queues of group into the first one */
+static void merge_group(struct list_head **group, unsigned int k, bool descend)
+{
+    if (!k)
+        return;
+
+    /* The result is known sorted only if all the queues were */
+    queue_t *dst = to_queue(group[0]);
+    bool sorted = true;
+    for (unsigned int i = 0; i < k; i++) {
+        queue_t *q = to_queue(group[i]);
+        materialize(q);
+        sorted = sorted && (descend ? q->sorted_desc : q->sorted_asc);
+        if (i)
+            queue_adopt(dst, q);
+    }
+    element_merge(group, k, descend);
+    dst->sorted_asc = (sorted && !descend) || dst->size <= 1;
+    dst->sorted_desc = (sorted && descend) || dst->size <= 1;
+}
+
 /* Merge all the queues into one sorted queue, which is in ascending/descending
  * order */
 int q_merge(struct list_head *head, bool descend)
@@ -421,25 +679,32 @@ int q_merge(struct list_head *head, bool descend)
     if (!head || list_empty(head))
         return 0;
 
-    if (list_is_singular(head))
-        return q_size(list_first_entry(head, queue_contex_t, chain)->q);
-    struct list_head *list[1000000];
-    queue_contex_t *entry, *safe;
-    int count = 0;
-    list_for_each_entry_safe (entry, safe, head, chain) {
-        list[count++] = entry->q;
-    }
-    int size = count;
-    for (int interval = 1; interval < size; interval *= 2) {
-        for (int i = 0; i + interval < size; i += interval * 2) {
-            if (descend) {
-                list[i] = mergeTwoList_d(list[i], list[i + interval]);
-            } else {
-                list[i] = mergeTwoList_a(list[i], list[i + interval]);
+    /* Merge groups of MERGE_FANIN queues into their first queue, then groups
+     * of those first queues, and so on. No memory beyond the tree is needed,
+     * however many queues there are.
+     */
+    struct list_head *group[MERGE_FANIN], *first = NULL;
+    for (size_t stride = 1;; stride *= MERGE_FANIN) {
+        queue_contex_t *entry;
+        unsigned int k = 0;
+        size_t idx = 0;
+        list_for_each_entry (entry, head, chain) {
+            if (!entry->q)
+                continue;
+            if (!idx)
+                first = entry->q;
+            if (idx % stride == 0) {
+                if (idx % (stride * MERGE_FANIN) == 0) {
+                    merge_group(group, k, descend);
+                    k = 0;
+                }
+                group[k++] = entry->q;
             }
+            idx++;
         }
+        merge_group(group, k, descend);
+        if (idx <= stride * MERGE_FANIN)
+            break;
     }
-    INIT_LIST_HEAD(head);
-    list_add_tail(head, list[0]);
-    return q_size(head);
+    return q_size(first);
 }
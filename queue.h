@@ -9,22 +9,77 @@
 
 #include <stdbool.h>
 #include <stddef.h>
+#include <stdint.h>
+#include <string.h>
 
 #include "harness.h"
 #include "list.h"
+#include "pool.h"
+#include "strpool.h"
 
 /**
  * element_t - Linked list element
  * @value: pointer to array holding string
  * @list: node of a doubly-linked list
- *
- * @value needs to be explicitly allocated and freed
+ * @len: length of the string, excluding the null terminator
+ * @key: first eight bytes of the string read as a big-endian integer, padded
+ *       with zeros, see element_key()
+ * @data: storage of the string, allocated together with the element
+ *
+ * Elements are carved from the pool of the queue they were inserted in.
+ * Short strings live in the same block as the element, with @value pointing
+ * to @data; longer ones are allocated separately, from the string pool.
  */
 typedef struct {
     char *value;
     struct list_head list;
+    size_t len;
+    uint64_t key;
+    char data[];
 } element_t;
 
+/**
+ * element_key() - Compute the key of a string
+ * @s: the string
+ * @len: length of @s
+ *
+ * Keys order like the strings they are computed from, as long as those
+ * differ within their first eight bytes.
+ */
+static inline uint64_t element_key(const char *s, size_t len)
+{
+    uint64_t key = 0;
+    memcpy(&key, s, len < 8 ? len : 8);
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+    key = __builtin_bswap64(key);
+#endif
+    return key;
+}
+
+/**
+ * element_cmp() - Compare the strings of two elements, like strcmp() does
+ * @a: an element
+ * @b: another element
+ *
+ * A single integer comparison of the keys decides most cases. The strings
+ * themselves are only read past their first eight bytes, when the keys tie.
+ *
+ * Return: negative, zero or positive if @a is less than, equal to or greater
+ * than @b respectively
+ */
+static inline int element_cmp(const element_t *a, const element_t *b)
+{
+    if (a->key != b->key)
+        return a->key < b->key ? -1 : 1;
+    if (a->value == b->value)
+        return 0;
+
+    /* A zero byte in equal keys is padding in both strings */
+    size_t la = a->len, lb = b->len, n = la < lb ? la : lb;
+    int cmp = n > 8 ? memcmp(a->value + 8, b->value + 8, n - 8) : 0;
+    return cmp ? cmp : (la > lb) - (la < lb);
+}
+
 /**
  * queue_contex_t - The context managing a chain of queues
  * @q: pointer to the head of the queue
@@ -41,6 +96,31 @@ typedef struct {
 
 /* Operations on queue */
 
+/**
+ * q_iter_t - Position of an element in a queue
+ * @head: header of the queue
+ * @node: where the element is, as known to the queue implementation
+ * @idx: where the element is within @node, if the implementation needs it
+ *
+ * Code outside of the queue implementation walks queues with the q_iter_*()
+ * functions, and does not assume that elements are linked together.
+ */
+typedef struct {
+    struct list_head *head;
+    struct list_head *node;
+    size_t idx;
+} q_iter_t;
+
+/**
+ * intern_strings - Whether strings are interned on insertion
+ *
+ * Strings too long to be stored inside their element normally get a copy of
+ * their own. When this is set, elements inserted with the same string share
+ * a single reference-counted copy instead. Short strings are not affected,
+ * as they take no extra storage anyway.
+ */
+extern int intern_strings;
+
 /**
  * q_new() - Create an empty queue whose next and prev pointer point to itself
  *
@@ -54,6 +134,18 @@ struct list_head *q_new();
  */
 void q_free(struct list_head *head);
 
+/**
+ * q_reserve() - Preallocate room for elements
+ * @head: header of queue
+ * @n: number of elements expected to be inserted
+ *
+ * Optional hint that makes the next @n insertions avoid further allocation
+ * of element nodes.
+ *
+ * Return: true for success, false for allocation failed or queue is NULL
+ */
+bool q_reserve(struct list_head *head, size_t n);
+
 /**
  * q_insert_head() - Insert an element in the head
  * @head: header of queue
@@ -78,6 +170,57 @@ bool q_insert_head(struct list_head *head, char *s);
  */
 bool q_insert_tail(struct list_head *head, char *s);
 
+/**
+ * q_insert_head_bulk() - Insert several elements in the head
+ * @head: header of queue
+ * @strs: strings would be inserted
+ * @n: number of strings
+ *
+ * Same as calling q_insert_head() on each string in turn, so the last one
+ * ends up first. Nodes for all the elements are allocated at once, and
+ * either every string is inserted or the queue is left unchanged.
+ *
+ * Return: true for success, false for allocation failed or queue is NULL
+ */
+bool q_insert_head_bulk(struct list_head *head, const char **strs, size_t n);
+
+/**
+ * q_insert_tail_bulk() - Insert several elements at the tail
+ * @head: header of queue
+ * @strs: strings would be inserted
+ * @n: number of strings
+ *
+ * Same as calling q_insert_tail() on each string in turn, with the
+ * guarantees of q_insert_head_bulk().
+ *
+ * Return: true for success, false for allocation failed or queue is NULL
+ */
+bool q_insert_tail_bulk(struct list_head *head, const char **strs, size_t n);
+
+/**
+ * q_insert_head_repeat() - Insert copies of a string in the head
+ * @head: header of queue
+ * @s: string would be inserted
+ * @n: number of copies
+ *
+ * Each element gets a copy of its own, see q_insert_head_bulk().
+ *
+ * Return: true for success, false for allocation failed or queue is NULL
+ */
+bool q_insert_head_repeat(struct list_head *head, const char *s, size_t n);
+
+/**
+ * q_insert_tail_repeat() - Insert copies of a string at the tail
+ * @head: header of queue
+ * @s: string would be inserted
+ * @n: number of copies
+ *
+ * Each element gets a copy of its own, see q_insert_head_bulk().
+ *
+ * Return: true for success, false for allocation failed or queue is NULL
+ */
+bool q_insert_tail_repeat(struct list_head *head, const char *s, size_t n);
+
 /**
  * q_remove_head() - Remove the element from head of queue
  * @head: header of queue
@@ -108,16 +251,49 @@ element_t *q_remove_head(struct list_head *head, char *sp, size_t bufsize);
  */
 element_t *q_remove_tail(struct list_head *head, char *sp, size_t bufsize);
 
+/**
+ * q_remove_head_nocopy() - Remove the element from head of queue without
+ *                          copying its string
+ * @head: header of queue
+ * @sp: if non-NULL, set to the string of the removed element
+ * @len: if non-NULL, set to the length of that string
+ *
+ * The string stays valid until the element is released, see
+ * q_release_element().
+ *
+ * Return: the pointer to element, %NULL if queue is NULL or empty.
+ */
+element_t *q_remove_head_nocopy(struct list_head *head,
+                                const char **sp,
+                                size_t *len);
+
+/**
+ * q_remove_tail_nocopy() - Remove the element from tail of queue without
+ *                          copying its string
+ * @head: header of queue
+ * @sp: if non-NULL, set to the string of the removed element
+ * @len: if non-NULL, set to the length of that string
+ *
+ * Return: the pointer to element, %NULL if queue is NULL or empty.
+ */
+element_t *q_remove_tail_nocopy(struct list_head *head,
+                                const char **sp,
+                                size_t *len);
+
 /**
  * q_release_element() - Release the element
  * @e: element would be released
  *
+ * The element goes back to the pool it was allocated from, so the queue it
+ * was removed from must not have been freed yet.
+ *
  * This function is intended for internal use only.
  */
 static inline void q_release_element(element_t *e)
 {
-    test_free(e->value);
-    test_free(e);
+    if (e->value != e->data)
+        strpool_put(e->value);
+    pool_free(e);
 }
 
 /**
@@ -155,6 +331,18 @@ bool q_delete_mid(struct list_head *head);
  */
 bool q_delete_dup(struct list_head *head);
 
+/**
+ * q_delete_dup_hash() - Delete all nodes whose string appears more than once
+ *                       in the queue, sorted or not.
+ * @head: header of queue
+ *
+ * The remaining elements keep their relative order. Duplicates are found in
+ * a single pass, using a hash table sized from the number of elements.
+ *
+ * Return: true for success, false if list is NULL or allocation failed.
+ */
+bool q_delete_dup_hash(struct list_head *head);
+
 /**
  * q_swap() - Swap every two adjacent nodes
  * @head: header of queue
@@ -172,6 +360,10 @@ void q_swap(struct list_head *head);
  * This function should not allocate or free any list elements
  * (e.g., by calling q_insert_head, q_insert_tail, or q_remove_head).
  * It should rearrange the existing ones.
+ *
+ * Takes constant time: only the direction in which the queue is read is
+ * flipped. The list behind @head is left in the order it was, so walk the
+ * queue with the q_iter_* functions rather than with list.h.
  */
 void q_reverse(struct list_head *head);
 
@@ -190,6 +382,80 @@ void q_reverse(struct list_head *head);
  */
 void q_reverseK(struct list_head *head, int k);
 
+/**
+ * q_iter_first() - Start walking a queue from its head
+ * @head: header of queue
+ * @it: position to initialize
+ *
+ * Return: the first element, %NULL if queue is NULL or empty
+ */
+element_t *q_iter_first(struct list_head *head, q_iter_t *it);
+
+/**
+ * q_iter_last() - Start walking a queue from its tail
+ * @head: header of queue
+ * @it: position to initialize
+ *
+ * Return: the last element, %NULL if queue is NULL or empty
+ */
+element_t *q_iter_last(struct list_head *head, q_iter_t *it);
+
+/**
+ * q_iter_next() - Move to the next element
+ * @it: position, which must refer to an element
+ *
+ * The queue must not be modified while it is being walked.
+ *
+ * Return: the next element, %NULL past the tail
+ */
+element_t *q_iter_next(q_iter_t *it);
+
+/**
+ * q_iter_prev() - Move to the previous element
+ * @it: position, which must refer to an element
+ *
+ * Return: the previous element, %NULL past the head
+ */
+element_t *q_iter_prev(q_iter_t *it);
+
+/**
+ * sort_alg - Algorithm used by q_sort()
+ *
+ * %SORT_TIM: adaptive natural merge sort, the default
+ * %SORT_MERGE: bottom-up merge sort, see list_sort()
+ * %SORT_RADIX: MSD radix sort over the bytes of the strings. It works on an
+ * array of the elements, which has to be allocated by q_sort_reserve()
+ * beforehand. Without it, q_sort() falls back to %SORT_TIM.
+ */
+enum { SORT_TIM, SORT_MERGE, SORT_RADIX };
+extern int sort_alg;
+
+/**
+ * sort_threads - Number of threads used by q_sort()
+ *
+ * With more than one thread, the queue is split into as many contiguous
+ * segments, sorted in parallel and merged pairwise, neighbouring merges
+ * running in parallel too. The result is the same as with a single thread.
+ * Queues too short to give each thread a few thousand elements use fewer.
+ */
+extern int sort_threads;
+
+/**
+ * q_sort_reserve() - Allocate the scratch memory needed to sort a queue
+ * @head: header of queue
+ *
+ * q_sort() is not allowed to allocate memory. Call this function before it
+ * when the selected algorithm needs some, and q_sort_release() afterwards.
+ *
+ * Return: true for success, false for allocation failed
+ */
+bool q_sort_reserve(struct list_head *head);
+
+/**
+ * q_sort_release() - Free the memory allocated by q_sort_reserve()
+ */
+void q_sort_release();
+
 /**
  * q_sort() - Sort elements of queue in ascending/descending order
  * @head: header of queue
@@ -197,9 +463,32 @@ void q_reverseK(struct list_head *head, int k);
  *
  * No effect if queue is NULL or empty. If there has only one element, do
  * nothing.
+ *
+ * Returns at once when the queue is known to be sorted already, see
+ * q_is_sorted().
  */
 void q_sort(struct list_head *head, bool descend);
 
+/**
+ * q_is_sorted() - Tell whether a queue is in ascending/descending order
+ * @head: header of queue
+ * @descend: whether to check for descending rather than ascending order
+ *
+ * Queues keep track of their order as elements are inserted, so the answer
+ * is usually known without looking at the elements. Otherwise the queue is
+ * walked once, and what is found is kept for the next calls.
+ *
+ * Return: true if the queue is sorted, false if not or if queue is NULL
+ */
+bool q_is_sorted(struct list_head *head, bool descend);
+
+/**
+ * q_sort_comparisons() - Get the cost of the most recent sort
+ *
+ * Return: the number of string comparisons made by the last call to q_sort()
+ */
+size_t q_sort_comparisons();
+
 /**
  * q_ascend() - Remove every node which has a node with a strictly less
  * value anywhere to the right side of it.
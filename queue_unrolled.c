@@ -0,0 +1,977 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "queue.h"
+#include "sort.h"
+#include "strhash.h"
+
+/* Unrolled implementation of the queue, selected with make BACKEND=unrolled.
+ *
+ * Elements are not linked to each other. The queue keeps pointers to them in
+ * chunks of CHUNK_SLOTS entries instead, and the chunks are what the header
+ * returned by q_new() links together. Walking the queue reads eight element
+ * pointers per cache line, rather than one node per element.
+ *
+ * The list member of elements is free for temporary use: sorting and merging
+ * link the elements through it, then store them back into the chunks.
+ */
+
+/* Nodes are carved from a per-queue pool in slots of this size. Strings
+ * short enough to fit in the rest of the slot are stored inside the node,
+ * longer ones get a separate allocation.
+ */
+#define ELEMENT_SLOT_SIZE 64
+#define ELEMENT_INLINE_LEN (ELEMENT_SLOT_SIZE - sizeof(element_t) - 1)
+
+/* Element pointers held by a chunk */
+#define CHUNK_SLOTS 64
+
+/**
+ * chunk_t - Block of consecutive elements of a queue
+ * @list: node in the list of chunks of the queue
+ * @start: first slot in use
+ * @end: one past the last slot in use
+ * @slots: the elements, in physical order
+ */
+typedef struct {
+    struct list_head list;
+    unsigned int start, end;
+    element_t *slots[CHUNK_SLOTS];
+} chunk_t;
+
+/**
+ * queue_t - Header of a queue, as returned by q_new()
+ * @head: head of the list of chunks, handed out to the callers
+ * @size: number of elements in the queue
+ * @reversed: whether the logical order is the reverse of the physical one
+ * @sorted_asc: whether the queue is known to be in ascending order
+ * @sorted_desc: whether the queue is known to be in descending order
+ * @pool: pool holding every element of this queue
+ * @ext: number of elements whose string is allocated outside of the node
+ * @spare: chunks which have been emptied
+ * @tmp: elements linked in logical order, while sorting or merging
+ *
+ * Chunks on @head are never empty. Emptied chunks are kept on @spare until the
+ * queue is freed, since that may happen where freeing memory is disallowed.
+ *
+ * The sorted flags are kept up to date on insertion and survive any removal,
+ * as in the list implementation.
+ */
+typedef struct {
+    struct list_head head;
+    size_t size;
+    bool reversed;
+    bool sorted_asc, sorted_desc;
+    pool_t pool;
+    size_t ext;
+    struct list_head spare;
+    struct list_head tmp;
+} queue_t;
+
+static inline queue_t *to_queue(struct list_head *head)
+{
+    return container_of(head, queue_t, head);
+}
+
+int intern_strings = 0;
+
+/* Create an empty queue */
+struct list_head *q_new()
+{
+    queue_t *q = malloc(sizeof(queue_t));
+    if (!q)
+        return NULL;
+
+    INIT_LIST_HEAD(&q->head);
+    q->size = 0;
+    q->reversed = false;
+    q->sorted_asc = q->sorted_desc = true;
+    pool_init(&q->pool, ELEMENT_SLOT_SIZE);
+    q->ext = 0;
+    INIT_LIST_HEAD(&q->spare);
+    INIT_LIST_HEAD(&q->tmp);
+    return &q->head;
+}
+
+/* Element at the position it refers to */
+static inline element_t **iter_slot(const q_iter_t *it)
+{
+    return &list_entry(it->node, chunk_t, list)->slots[it->idx];
+}
+
+/* Start at the first or last element in physical order */
+static element_t *iter_begin(struct list_head *head, q_iter_t *it, bool last)
+{
+    it->head = head;
+    it->node = last ? head->prev : head->next;
+    if (it->node == head)
+        return NULL;
+    chunk_t *c = list_entry(it->node, chunk_t, list);
+    it->idx = last ? c->end - 1 : c->start;
+    return c->slots[it->idx];
+}
+
+/* Move forward in physical order */
+static element_t *iter_fwd(q_iter_t *it)
+{
+    chunk_t *c = list_entry(it->node, chunk_t, list);
+    if (++it->idx < c->end)
+        return c->slots[it->idx];
+
+    it->node = it->node->next;
+    if (it->node == it->head)
+        return NULL;
+    c = list_entry(it->node, chunk_t, list);
+    it->idx = c->start;
+    return c->slots[it->idx];
+}
+
+/* Move backward in physical order */
+static element_t *iter_back(q_iter_t *it)
+{
+    chunk_t *c = list_entry(it->node, chunk_t, list);
+    if (it->idx > c->start)
+        return c->slots[--it->idx];
+
+    it->node = it->node->prev;
+    if (it->node == it->head)
+        return NULL;
+    c = list_entry(it->node, chunk_t, list);
+    it->idx = c->end - 1;
+    return c->slots[it->idx];
+}
+
+element_t *q_iter_first(struct list_head *head, q_iter_t *it)
+{
+    if (!head)
+        return NULL;
+    return iter_begin(head, it, to_queue(head)->reversed);
+}
+
+element_t *q_iter_last(struct list_head *head, q_iter_t *it)
+{
+    if (!head)
+        return NULL;
+    return iter_begin(head, it, !to_queue(head)->reversed);
+}
+
+element_t *q_iter_next(q_iter_t *it)
+{
+    return to_queue(it->head)->reversed ? iter_back(it) : iter_fwd(it);
+}
+
+element_t *q_iter_prev(q_iter_t *it)
+{
+    return to_queue(it->head)->reversed ? iter_fwd(it) : iter_back(it);
+}
+
+/* Free all storage used by queue */
+void q_free(struct list_head *head)
+{
+    if (!head)
+        return;
+
+    queue_t *q = to_queue(head);
+    if (q->ext) {
+        q_iter_t it;
+        element_t *e;
+        for (e = iter_begin(head, &it, false); e; e = iter_fwd(&it)) {
+            if (e->value != e->data)
+                strpool_put(e->value);
+        }
+    }
+    /* Nodes go away together with their slabs */
+    pool_destroy(&q->pool);
+
+    chunk_t *c, *safe;
+    list_splice(&q->spare, head);
+    list_for_each_entry_safe (c, safe, head, list)
+        free(c);
+    free(q);
+}
+
+/* Allocate an element from the pool of q holding a copy of s, of length len */
+static element_t *element_new(queue_t *q, const char *s, size_t len)
+{
+    element_t *e = pool_alloc(&q->pool);
+    if (!e)
+        return NULL;
+
+    if (len <= ELEMENT_INLINE_LEN) {
+        e->value = e->data;
+        memcpy(e->value, s, len);
+        e->value[len] = '\0';
+    } else {
+        e->value = strpool_get(s, len, intern_strings);
+        if (!e->value) {
+            pool_free(e);
+            return NULL;
+        }
+        q->ext++;
+    }
+    e->len = len;
+    e->key = element_key(e->value, len);
+    return e;
+}
+
+/* Release an element no longer held by q */
+static inline void element_delete(queue_t *q, element_t *e)
+{
+    if (e->value != e->data)
+        q->ext--;
+    q_release_element(e);
+}
+
+/* Take an emptied chunk if there is one, or allocate a new one */
+static chunk_t *chunk_get(queue_t *q)
+{
+    if (list_empty(&q->spare))
+        return malloc(sizeof(chunk_t));
+    chunk_t *c = list_first_entry(&q->spare, chunk_t, list);
+    list_del(&c->list);
+    return c;
+}
+
+static inline void chunk_put(queue_t *q, chunk_t *c)
+{
+    list_move(&c->list, &q->spare);
+}
+
+/* Add e at the physical head or tail */
+static bool push(queue_t *q, element_t *e, bool back)
+{
+    chunk_t *c = NULL;
+    if (!list_empty(&q->head)) {
+        c = back ? list_last_entry(&q->head, chunk_t, list)
+                 : list_first_entry(&q->head, chunk_t, list);
+    }
+
+    if (!c || (back ? c->end == CHUNK_SLOTS : !c->start)) {
+        c = chunk_get(q);
+        if (!c)
+            return false;
+        /* Leave room on the side the queue grows to */
+        c->start = c->end = back ? 0 : CHUNK_SLOTS;
+        if (back)
+            list_add_tail(&c->list, &q->head);
+        else
+            list_add(&c->list, &q->head);
+    }
+
+    if (back)
+        c->slots[c->end++] = e;
+    else
+        c->slots[--c->start] = e;
+    q->size++;
+    return true;
+}
+
+/* Take the element at the physical head or tail away from q */
+static element_t *pop(queue_t *q, bool back)
+{
+    if (!q->size)
+        return NULL;
+
+    chunk_t *c = back ? list_last_entry(&q->head, chunk_t, list)
+                      : list_first_entry(&q->head, chunk_t, list);
+    element_t *e = back ? c->slots[--c->end] : c->slots[c->start++];
+    if (c->start == c->end)
+        chunk_put(q, c);
+    q->size--;
+    if (e->value != e->data)
+        q->ext--;
+    return e;
+}
+
+/* Return the element at the head or tail of q, NULL if q is empty */
+static element_t *queue_end(queue_t *q, bool tail)
+{
+    if (!q->size)
+        return NULL;
+    q_iter_t it;
+    return iter_begin(&q->head, &it, tail != q->reversed);
+}
+
+/* Update what is known of the order of q, as e is added next to end, the
+ * element at its head or tail, NULL for an empty queue
+ */
+static inline void track_insert(queue_t *q,
+                                const element_t *end,
+                                const element_t *e,
+                                bool tail)
+{
+    if (!end || !(q->sorted_asc || q->sorted_desc))
+        return;
+    int cmp = tail ? element_cmp(end, e) : element_cmp(e, end);
+    q->sorted_asc = q->sorted_asc && cmp <= 0;
+    q->sorted_desc = q->sorted_desc && cmp >= 0;
+}
+
+/* Forget the order of q, after its elements have been reordered */
+static inline void track_reorder(queue_t *q)
+{
+    /* Equal elements are sorted whatever their order */
+    if (!(q->sorted_asc && q->sorted_desc))
+        q->sorted_asc = q->sorted_desc = false;
+}
+
+/* Make the physical order of q the logical one */
+static void materialize(queue_t *q)
+{
+    if (!q->reversed)
+        return;
+
+    chunk_t *c;
+    list_for_each_entry (c, &q->head, list) {
+        for (unsigned int i = c->start, j = c->end - 1; i < j; i++, j--) {
+            element_t *e = c->slots[i];
+            c->slots[i] = c->slots[j];
+            c->slots[j] = e;
+        }
+    }
+
+    /* Reverse the list of chunks by swapping the links of every node */
+    struct list_head *node = &q->head;
+    do {
+        struct list_head *next = node->next;
+        node->next = node->prev;
+        node->prev = next;
+        node = next;
+    } while (node != &q->head);
+    q->reversed = false;
+}
+
+/* Link the elements of q on q->tmp in logical order */
+static void gather(queue_t *q)
+{
+    q_iter_t it;
+    INIT_LIST_HEAD(&q->tmp);
+    for (element_t *e = q_iter_first(&q->head, &it); e; e = q_iter_next(&it))
+        list_add_tail(&e->list, &q->tmp);
+}
+
+/* Store the elements linked on q->tmp back into the chunks of q, which have
+ * room for all of them, filling each chunk from its first slot.
+ */
+static void scatter(queue_t *q)
+{
+    LIST_HEAD(chunks);
+    list_splice_init(&q->head, &chunks);
+
+    chunk_t *c = NULL;
+    element_t *e;
+    list_for_each_entry (e, &q->tmp, list) {
+        if (!c || c->end == CHUNK_SLOTS) {
+            c = list_first_entry(&chunks, chunk_t, list);
+            list_move_tail(&c->list, &q->head);
+            c->start = c->end = 0;
+        }
+        c->slots[c->end++] = e;
+    }
+    INIT_LIST_HEAD(&q->tmp);
+    list_splice(&chunks, &q->spare);
+    q->reversed = false;
+}
+
+/**
+ * writer_t - Position where the next element is stored while compacting
+ * @q: the queue being compacted
+ * @c: current chunk, NULL before the first element is stored
+ * @idx: next slot of @c
+ * @n: number of elements stored
+ *
+ * Elements kept by a pass over the queue in physical order are stored back
+ * in that order. The writer never gets ahead of the elements being read.
+ */
+typedef struct {
+    queue_t *q;
+    chunk_t *c;
+    unsigned int idx;
+    size_t n;
+} writer_t;
+
+static void writer_put(writer_t *w, element_t *e)
+{
+    if (!w->c) {
+        w->c = list_first_entry(&w->q->head, chunk_t, list);
+        w->idx = w->c->start;
+    } else if (w->idx == CHUNK_SLOTS) {
+        w->c->end = CHUNK_SLOTS;
+        w->c = list_entry(w->c->list.next, chunk_t, list);
+        w->c->start = w->idx = 0;
+    }
+    w->c->slots[w->idx++] = e;
+    w->n++;
+}
+
+/* Drop the chunks past the last element stored */
+static void writer_finish(writer_t *w)
+{
+    queue_t *q = w->q;
+    struct list_head *last = &q->head;
+    if (w->c) {
+        w->c->end = w->idx;
+        last = &w->c->list;
+    }
+    while (q->head.prev != last)
+        list_move(q->head.prev, &q->spare);
+    q->size = w->n;
+}
+
+bool q_reserve(struct list_head *head, size_t n)
+{
+    if (!head)
+        return false;
+
+    queue_t *q = to_queue(head);
+    size_t avail = 0;
+    struct list_head *node;
+    list_for_each (node, &q->spare)
+        avail += CHUNK_SLOTS;
+    while (avail < n) {
+        chunk_t *c = malloc(sizeof(chunk_t));
+        if (!c)
+            return false;
+        list_add(&c->list, &q->spare);
+        avail += CHUNK_SLOTS;
+    }
+    return pool_reserve(&q->pool, n);
+}
+
+/* Insert an element at the head or tail of queue */
+static bool insert(struct list_head *head, const char *s, bool tail)
+{
+    if (__glibc_unlikely(!head || !s))
+        return false;
+
+    queue_t *q = to_queue(head);
+    element_t *e = element_new(q, s, strlen(s));
+    if (!e)
+        return false;
+    element_t *end = queue_end(q, tail);
+    if (!push(q, e, tail != q->reversed)) {
+        element_delete(q, e);
+        return false;
+    }
+    track_insert(q, end, e, tail);
+    return true;
+}
+
+/* Insert an element at head of queue */
+bool q_insert_head(struct list_head *head, char *s)
+{
+    return insert(head, s, false);
+}
+
+/* Insert an element at tail of queue */
+bool q_insert_tail(struct list_head *head, char *s)
+{
+    return insert(head, s, true);
+}
+
+/* Insert n elements, holding strs[i] or copies of s when strs is NULL, at the
+ * head or tail of the queue. Should any allocation fail, the elements already
+ * inserted are taken out again.
+ */
+static bool insert_bulk(struct list_head *head,
+                        const char **strs,
+                        const char *s,
+                        size_t n,
+                        bool tail)
+{
+    if (!head || (!strs && !s))
+        return false;
+
+    queue_t *q = to_queue(head);
+    if (!pool_reserve(&q->pool, n))
+        return false;
+
+    bool back = tail != q->reversed;
+    bool sorted_asc = q->sorted_asc, sorted_desc = q->sorted_desc;
+    size_t len = s ? strlen(s) : 0;
+    element_t *end = queue_end(q, tail);
+    for (size_t i = 0; i < n; i++) {
+        const char *str = strs ? strs[i] : s;
+        element_t *e =
+            str ? element_new(q, str, strs ? strlen(str) : len) : NULL;
+        if (!e || !push(q, e, back)) {
+            if (e)
+                element_delete(q, e);
+            while (i--)
+                q_release_element(pop(q, back));
+            q->sorted_asc = sorted_asc;
+            q->sorted_desc = sorted_desc;
+            return false;
+        }
+        track_insert(q, end, e, tail);
+        end = e;
+    }
+    return true;
+}
+
+bool q_insert_head_bulk(struct list_head *head, const char **strs, size_t n)
+{
+    return insert_bulk(head, strs, NULL, n, false);
+}
+
+bool q_insert_tail_bulk(struct list_head *head, const char **strs, size_t n)
+{
+    return insert_bulk(head, strs, NULL, n, true);
+}
+
+bool q_insert_head_repeat(struct list_head *head, const char *s, size_t n)
+{
+    return insert_bulk(head, NULL, s, n, false);
+}
+
+bool q_insert_tail_repeat(struct list_head *head, const char *s, size_t n)
+{
+    return insert_bulk(head, NULL, s, n, true);
+}
+
+/* Copy the string of e into sp, truncated to bufsize - 1 characters. Only
+ * the string and its terminator are written.
+ */
+static inline void element_copy(const element_t *e, char *sp, size_t bufsize)
+{
+    if (!sp || !bufsize)
+        return;
+    size_t n = e->len < bufsize - 1 ? e->len : bufsize - 1;
+    memcpy(sp, e->value, n);
+    sp[n] = '\0';
+}
+
+/* Remove an element from head of queue */
+element_t *q_remove_head(struct list_head *head, char *sp, size_t bufsize)
+{
+    if (!head)
+        return NULL;
+    queue_t *q = to_queue(head);
+    element_t *e = pop(q, q->reversed);
+    if (e)
+        element_copy(e, sp, bufsize);
+    return e;
+}
+
+/* Remove an element from tail of queue */
+element_t *q_remove_tail(struct list_head *head, char *sp, size_t bufsize)
+{
+    if (!head)
+        return NULL;
+    queue_t *q = to_queue(head);
+    element_t *e = pop(q, !q->reversed);
+    if (e)
+        element_copy(e, sp, bufsize);
+    return e;
+}
+
+/* Remove an element from head of queue, handing out its string in place */
+element_t *q_remove_head_nocopy(struct list_head *head,
+                                const char **sp,
+                                size_t *len)
+{
+    element_t *e = q_remove_head(head, NULL, 0);
+    if (e && sp)
+        *sp = e->value;
+    if (e && len)
+        *len = e->len;
+    return e;
+}
+
+/* Remove an element from tail of queue, handing out its string in place */
+element_t *q_remove_tail_nocopy(struct list_head *head,
+                                const char **sp,
+                                size_t *len)
+{
+    element_t *e = q_remove_tail(head, NULL, 0);
+    if (e && sp)
+        *sp = e->value;
+    if (e && len)
+        *len = e->len;
+    return e;
+}
+
+/* Return number of elements in queue */
+int q_size(struct list_head *head)
+{
+    if (!head)
+        return 0;
+    return to_queue(head)->size;
+}
+
+/* Delete the middle node in queue */
+bool q_delete_mid(struct list_head *head)
+{
+    if (!head || list_empty(head))
+        return false;
+
+    /* Same node as the list implementation: the later of the two middle
+     * ones, counting from the tail
+     */
+    queue_t *q = to_queue(head);
+    size_t pos = (q->size - 1) / 2;
+    if (q->reversed)
+        pos = q->size - 1 - pos;
+
+    chunk_t *c;
+    list_for_each_entry (c, head, list) {
+        if (pos < c->end - c->start)
+            break;
+        pos -= c->end - c->start;
+    }
+
+    /* Close the gap from the shorter side */
+    unsigned int i = c->start + pos;
+    element_t *e = c->slots[i];
+    if (pos < (c->end - c->start) / 2) {
+        memmove(&c->slots[c->start + 1], &c->slots[c->start],
+                pos * sizeof(element_t *));
+        c->start++;
+    } else {
+        memmove(&c->slots[i], &c->slots[i + 1],
+                (c->end - i - 1) * sizeof(element_t *));
+        c->end--;
+    }
+    if (c->start == c->end)
+        chunk_put(q, c);
+    q->size--;
+    element_delete(q, e);
+    return true;
+}
+
+/* Delete all nodes that have duplicate string */
+bool q_delete_dup(struct list_head *head)
+{
+    if (!head)
+        return false;
+
+    /* Adjacency does not depend on the direction */
+    queue_t *q = to_queue(head);
+    writer_t w = {.q = q, .c = NULL, .idx = 0, .n = 0};
+    q_iter_t it;
+    bool dup = false;
+    element_t *next;
+    for (element_t *e = iter_begin(head, &it, false); e; e = next) {
+        next = iter_fwd(&it);
+        bool next_dup = next && !element_cmp(e, next);
+        if (dup || next_dup)
+            element_delete(q, e);
+        else
+            writer_put(&w, e);
+        dup = next_dup;
+    }
+    writer_finish(&w);
+    return true;
+}
+
+/**
+ * dedup_slot_t - Slot of the table used by q_delete_dup_hash()
+ * @hash: hash of the string of @e
+ * @e: first element holding the string, NULL for an empty slot
+ * @dup: whether the string has been seen again after @e
+ */
+typedef struct {
+    uint64_t hash;
+    element_t *e;
+    bool dup;
+} dedup_slot_t;
+
+/* Return the slot of the string of e, which is empty if it is not there */
+static dedup_slot_t *dedup_find(dedup_slot_t *table,
+                                size_t cap,
+                                const element_t *e,
+                                uint64_t hash)
+{
+    size_t i = hash & (cap - 1);
+    while (table[i].e &&
+           (table[i].hash != hash || element_cmp(table[i].e, e)))
+        i = (i + 1) & (cap - 1);
+    return &table[i];
+}
+
+/* Delete all nodes whose string appears more than once, in any order */
+bool q_delete_dup_hash(struct list_head *head)
+{
+    if (!head)
+        return false;
+
+    /* Open addressing with linear probing, kept at most half full */
+    queue_t *q = to_queue(head);
+    size_t cap = 16;
+    while (cap < 2 * q->size)
+        cap <<= 1;
+    dedup_slot_t *table = malloc(cap * sizeof(dedup_slot_t));
+    if (!table)
+        return false;
+    memset(table, 0, cap * sizeof(dedup_slot_t));
+
+    /* Later copies go in the first pass, first ones in the second, once the
+     * whole queue is seen. Only first copies are left to look up by then.
+     */
+    for (int pass = 0; pass < 2; pass++) {
+        writer_t w = {.q = q, .c = NULL, .idx = 0, .n = 0};
+        q_iter_t it;
+        element_t *e, *next;
+        for (e = iter_begin(head, &it, false); e; e = next) {
+            next = iter_fwd(&it);
+            uint64_t hash = strhash(e->value, e->len, 0);
+            dedup_slot_t *slot = dedup_find(table, cap, e, hash);
+            if (pass ? slot->dup : !!slot->e) {
+                slot->dup = true;
+                element_delete(q, e);
+            } else {
+                if (!pass)
+                    *slot = (dedup_slot_t){.hash = hash, .e = e, .dup = false};
+                writer_put(&w, e);
+            }
+        }
+        writer_finish(&w);
+    }
+    free(table);
+    return true;
+}
+
+/* Swap every two adjacent nodes */
+void q_swap(struct list_head *head)
+{
+    if (!head)
+        return;
+
+    materialize(to_queue(head));
+    if (q_size(head) > 1)
+        track_reorder(to_queue(head));
+    q_iter_t it;
+    element_t *e = iter_begin(head, &it, false);
+    while (e) {
+        element_t **a = iter_slot(&it);
+        if (!iter_fwd(&it))
+            break;
+        element_t **b = iter_slot(&it);
+        *a = *b;
+        *b = e;
+        e = iter_fwd(&it);
+    }
+}
+
+/* Reverse elements in queue */
+void q_reverse(struct list_head *head)
+{
+    if (!head)
+        return;
+    queue_t *q = to_queue(head);
+    q->reversed ^= true;
+    bool sorted_asc = q->sorted_asc;
+    q->sorted_asc = q->sorted_desc;
+    q->sorted_desc = sorted_asc;
+}
+
+/* Reverse the nodes of the list k at a time */
+void q_reverseK(struct list_head *head, int k)
+{
+    if (!head || k <= 1)
+        return;
+
+    materialize(to_queue(head));
+    if (q_size(head) >= k)
+        track_reorder(to_queue(head));
+    q_iter_t left;
+    element_t *e = iter_begin(head, &left, false);
+    while (e) {
+        /* Find the last node of the group, and the node after it */
+        q_iter_t right = left;
+        int n = 1;
+        while (n < k && iter_fwd(&right))
+            n++;
+        if (n < k)
+            break;
+        q_iter_t next = right;
+        e = iter_fwd(&next);
+
+        for (int i = 0; i < k / 2; i++) {
+            element_t **a = iter_slot(&left), **b = iter_slot(&right), *t = *a;
+            *a = *b;
+            *b = t;
+            iter_fwd(&left);
+            iter_back(&right);
+        }
+        left = next;
+    }
+}
+
+/* Sort elements of queue in ascending/descending order */
+void q_sort(struct list_head *head, bool descend)
+{
+    if (!head)
+        return;
+
+    queue_t *q = to_queue(head);
+    if (descend ? q->sorted_desc : q->sorted_asc) {
+        sort_skipped();
+        return;
+    }
+    gather(q);
+    element_sort(&q->tmp, q->size, descend);
+    scatter(q);
+    q->sorted_asc = !descend;
+    q->sorted_desc = descend;
+}
+
+bool q_is_sorted(struct list_head *head, bool descend)
+{
+    if (!head)
+        return false;
+
+    queue_t *q = to_queue(head);
+    if (!(descend ? q->sorted_desc : q->sorted_asc)) {
+        /* Find out once, the flags being kept up to date from then on */
+        q_iter_t it;
+        element_t *e = q_iter_first(head, &it), *next;
+        bool asc = true, desc = true;
+        for (; e && (next = q_iter_next(&it)) && (asc || desc); e = next) {
+            int cmp = element_cmp(e, next);
+            asc = asc && cmp <= 0;
+            desc = desc && cmp >= 0;
+        }
+        q->sorted_asc = asc;
+        q->sorted_desc = desc;
+    }
+    return descend ? q->sorted_desc : q->sorted_asc;
+}
+
+/* Delete every element of q->tmp that has an element comparing the wrong way
+ * somewhere to its right, keeping the rest
+ */
+static void tmp_monotonic(queue_t *q, bool descend)
+{
+    /* Walk from the tail, keeping the least or greatest value seen so far */
+    element_t *last = list_last_entry(&q->tmp, element_t, list);
+    while (last->list.prev != &q->tmp) {
+        element_t *prev = list_entry(last->list.prev, element_t, list);
+        int cmp = element_cmp(prev, last);
+        if (descend ? cmp < 0 : cmp > 0) {
+            list_del(&prev->list);
+            element_delete(q, prev);
+            q->size--;
+        } else {
+            last = prev;
+        }
+    }
+}
+
+/* Remove every node which has a node with a strictly less value anywhere to
+ * the right side of it */
+int q_ascend(struct list_head *head)
+{
+    if (!head || list_empty(head))
+        return 0;
+
+    queue_t *q = to_queue(head);
+    if (q->sorted_asc)
+        return q->size;
+    gather(q);
+    tmp_monotonic(q, false);
+    scatter(q);
+    q->sorted_asc = true;
+    return q->size;
+}
+
+/* Remove every node which has a node with a strictly greater value anywhere to
+ * the right side of it */
+int q_descend(struct list_head *head)
+{
+    if (!head || list_empty(head))
+        return 0;
+
+    queue_t *q = to_queue(head);
+    if (q->sorted_desc)
+        return q->size;
+    gather(q);
+    tmp_monotonic(q, true);
+    scatter(q);
+    q->sorted_desc = true;
+    return q->size;
+}
+
+/* Make dst the owner of every element of src, which have been gathered on
+ * src->tmp, and of every chunk of src.
+ */
+static void queue_adopt(queue_t *dst, queue_t *src)
+{
+    dst->size += src->size;
+    src->size = 0;
+    pool_merge(&dst->pool, &src->pool);
+    dst->ext += src->ext;
+    src->ext = 0;
+    list_splice_tail_init(&src->head, &dst->head);
+    list_splice_tail_init(&src->spare, &dst->spare);
+    src->reversed = false;
+    src->sorted_asc = src->sorted_desc = true;
+}
+
+/* Merge the gathered elements of the k sorted queues of group into the
+ * first one
+ */
+static void merge_group(queue_t **group, unsigned int k, bool descend)
+{
+    if (!k)
+        return;
+
+    /* The result is known sorted only if all the queues were */
+    struct list_head *lists[MERGE_FANIN];
+    queue_t *dst = group[0];
+    bool sorted = true;
+    for (unsigned int i = 0; i < k; i++) {
+        sorted = sorted &&
+                 (descend ? group[i]->sorted_desc : group[i]->sorted_asc);
+        if (i)
+            queue_adopt(dst, group[i]);
+        lists[i] = &group[i]->tmp;
+    }
+    element_merge(lists, k, descend);
+    dst->sorted_asc = (sorted && !descend) || dst->size <= 1;
+    dst->sorted_desc = (sorted && descend) || dst->size <= 1;
+}
+
+/* Merge all the queues into one sorted queue, which is in ascending/descending
+ * order */
+int q_merge(struct list_head *head, bool descend)
+{
+    if (!head || list_empty(head))
+        return 0;
+
+    queue_contex_t *entry;
+    list_for_each_entry (entry, head, chain) {
+        if (entry->q)
+            gather(to_queue(entry->q));
+    }
+
+    /* Same grouping as the list implementation, on the gathered elements */
+    queue_t *group[MERGE_FANIN], *first = NULL;
+    for (size_t stride = 1;; stride *= MERGE_FANIN) {
+        unsigned int k = 0;
+        size_t idx = 0;
+        list_for_each_entry (entry, head, chain) {
+            if (!entry->q)
+                continue;
+            if (!idx)
+                first = to_queue(entry->q);
+            if (idx % stride == 0) {
+                if (idx % (stride * MERGE_FANIN) == 0) {
+                    merge_group(group, k, descend);
+                    k = 0;
+                }
+                group[k++] = to_queue(entry->q);
+            }
+            idx++;
+        }
+        merge_group(group, k, descend);
+        if (idx <= stride * MERGE_FANIN)
+            break;
+    }
+
+    if (!first)
+        return 0;
+    scatter(first);
+    return first->size;
+}
@@ -0,0 +1,177 @@
+#include <string.h>
+
+#include "radix.h"
+
+/* Buckets up to this size are finished with insertion sort */
+#define RADIX_INSERTION 32
+
+/* Bytes distributed before tied buckets are finished with merge sort. This
+ * bounds the recursion, each level of which uses a 256-entry count array.
+ */
+#define RADIX_MAX_DEPTH 32
+
+typedef struct {
+    bool descend;
+    size_t cmps;
+} radix_ctx_t;
+
+/* Read eight bytes of the string from depth on, padding with zeros. Keys are
+ * inverted in descending order, so that the distribution stays ascending.
+ */
+static inline uint64_t load_key(const element_t *e, size_t depth, bool descend)
+{
+    const unsigned char *s = (const unsigned char *) e->value;
+    uint64_t key = 0;
+    for (size_t i = depth; i < depth + 8; i++)
+        key = key << 8 | (i < e->len ? s[i] : 0);
+    return descend ? ~key : key;
+}
+
+/* Compare two items whose strings agree on their first depth bytes */
+static int item_cmp(radix_ctx_t *ctx,
+                    const radix_item_t *a,
+                    const radix_item_t *b,
+                    size_t depth)
+{
+    ctx->cmps++;
+    if (a->key != b->key)
+        return a->key < b->key ? -1 : 1;
+
+    /* Equal keys imply that a string ending before the end of the key ends
+     * at the same place as the other one, but one ending right at the end
+     * of the key may still be a prefix of the other
+     */
+    size_t start = depth + 8, la = a->e->len, lb = b->e->len;
+    if (la <= start && lb <= start)
+        return 0;
+
+    int cmp = 0;
+    if (la > start && lb > start)
+        cmp = memcmp(a->e->value + start, b->e->value + start,
+                     (la < lb ? la : lb) - start);
+    if (!cmp)
+        cmp = (la > lb) - (la < lb);
+    return ctx->descend ? -cmp : cmp;
+}
+
+static void insertion_sort(radix_ctx_t *ctx,
+                           radix_item_t *a,
+                           size_t n,
+                           size_t depth)
+{
+    for (size_t i = 1; i < n; i++) {
+        radix_item_t x = a[i];
+        size_t j = i;
+        while (j > 0 && item_cmp(ctx, &a[j - 1], &x, depth) > 0) {
+            a[j] = a[j - 1];
+            j--;
+        }
+        a[j] = x;
+    }
+}
+
+static void merge_sort(radix_ctx_t *ctx,
+                       radix_item_t *a,
+                       radix_item_t *aux,
+                       size_t n,
+                       size_t depth)
+{
+    if (n <= RADIX_INSERTION) {
+        insertion_sort(ctx, a, n, depth);
+        return;
+    }
+
+    size_t mid = n / 2;
+    merge_sort(ctx, a, aux, mid, depth);
+    merge_sort(ctx, a + mid, aux + mid, n - mid, depth);
+
+    memcpy(aux, a, n * sizeof(*a));
+    size_t i = 0, j = mid, k = 0;
+    while (i < mid && j < n) {
+        if (item_cmp(ctx, &aux[j], &aux[i], depth) < 0)
+            a[k++] = aux[j++];
+        else
+            a[k++] = aux[i++];
+    }
+    while (i < mid)
+        a[k++] = aux[i++];
+    while (j < n)
+        a[k++] = aux[j++];
+}
+
+/* Reload the keys of a bucket whose strings agree on their first depth bytes.
+ * Return whether any of those strings goes on past depth.
+ */
+static bool reload_keys(radix_ctx_t *ctx,
+                        radix_item_t *a,
+                        size_t n,
+                        size_t depth)
+{
+    bool more = false;
+    for (size_t i = 0; i < n; i++) {
+        a[i].key = load_key(a[i].e, depth, ctx->descend);
+        more |= a[i].e->len > depth;
+    }
+    return more;
+}
+
+/* Distribute items on the byte of their key selected by shift */
+static void msd_sort(radix_ctx_t *ctx,
+                     radix_item_t *a,
+                     radix_item_t *aux,
+                     size_t n,
+                     unsigned int shift,
+                     size_t depth)
+{
+    if (n <= RADIX_INSERTION) {
+        insertion_sort(ctx, a, n, depth);
+        return;
+    }
+
+    size_t count[256] = {0};
+    for (size_t i = 0; i < n; i++)
+        count[(a[i].key >> shift) & 0xff]++;
+
+    /* Nothing to move when every item falls in the same bucket */
+    if (count[(a[0].key >> shift) & 0xff] != n) {
+        size_t pos[256];
+        for (size_t b = 0, sum = 0; b < 256; b++) {
+            pos[b] = sum;
+            sum += count[b];
+        }
+        for (size_t i = 0; i < n; i++)
+            aux[pos[(a[i].key >> shift) & 0xff]++] = a[i];
+        memcpy(a, aux, n * sizeof(*a));
+    }
+
+    /* Strings that ended before this byte are all equal within a bucket */
+    size_t ended = ctx->descend ? 0xff : 0;
+    for (size_t b = 0, start = 0; b < 256; start += count[b++]) {
+        if (count[b] < 2 || b == ended)
+            continue;
+
+        radix_item_t *bucket = a + start;
+        if (shift) {
+            msd_sort(ctx, bucket, aux, count[b], shift - 8, depth);
+        } else if (reload_keys(ctx, bucket, count[b], depth + 8)) {
+            if (depth + 8 >= RADIX_MAX_DEPTH)
+                merge_sort(ctx, bucket, aux, count[b], depth + 8);
+            else
+                msd_sort(ctx, bucket, aux, count[b], 56, depth + 8);
+        }
+    }
+}
+
+size_t radix_sort(radix_item_t *items,
+                  radix_item_t *aux,
+                  size_t n,
+                  bool descend)
+{
+    radix_ctx_t ctx = {.descend = descend, .cmps = 0};
+    for (size_t i = 0; i < n; i++) {
+        uint64_t key = items[i].e->key;
+        items[i].key = descend ? ~key : key;
+    }
+    msd_sort(&ctx, items, aux, n, 56, 0);
+    return ctx.cmps;
+}
@@ -0,0 +1,39 @@
+#ifndef LAB0_RADIX_H
+#define LAB0_RADIX_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "queue.h"
+
+/**
+ * radix_item_t - Entry of the array sorted by radix_sort()
+ * @key: eight bytes of the string, read big-endian, at the current depth
+ * @e: element holding the string
+ */
+typedef struct {
+    uint64_t key;
+    element_t *e;
+} radix_item_t;
+
+/**
+ * radix_sort() - Sort elements by the bytes of their strings
+ * @items: array whose @e members refer to the elements to sort
+ * @aux: scratch array of the same length
+ * @n: number of elements
+ * @descend: whether or not to sort in descending order
+ *
+ * MSD radix sort: items are distributed one byte at a time, using cached
+ * eight-byte keys so that most passes do not touch the strings at all.
+ * Small buckets, and buckets still tied after many bytes, are finished with
+ * comparison sorts. Elements whose strings are equal keep their order.
+ *
+ * Return: the number of string comparisons made
+ */
+size_t radix_sort(radix_item_t *items,
+                  radix_item_t *aux,
+                  size_t n,
+                  bool descend);
+
+#endif /* LAB0_RADIX_H */
@@ -28,6 +28,8 @@
 #define _GNU_SOURCE
 #endif
 
+#include <string.h>
+
 #include "random.h"
 
 #if defined(__linux__) || defined(__GNU__)
@@ -293,3 +295,32 @@ int randombytes(uint8_t *buf, size_t n)
 #error "randombytes(...) is not supported on this platform"
 #endif
 }
+
+void random_strings(prng_t *r,
+                    char *bufs,
+                    size_t n,
+                    size_t stride,
+                    size_t min_len,
+                    const char *charset,
+                    size_t nchars)
+{
+    size_t total = n * stride, i;
+    uint8_t *p = (uint8_t *) bufs;
+    for (i = 0; i + sizeof(uint64_t) <= total; i += sizeof(uint64_t)) {
+        uint64_t x = prng_next(r);
+        memcpy(p + i, &x, sizeof(x));
+    }
+    if (i < total) {
+        uint64_t x = prng_next(r);
+        memcpy(p + i, &x, total - i);
+    }
+
+    /* Scaling rather than taking the remainder spares a division per
+     * character
+     */
+    for (i = 0; i < total; i++)
+        p[i] = charset[(p[i] * nchars) >> 8];
+
+    for (i = 0; i < n; i++)
+        bufs[i * stride + min_len + prng_below(r, stride - min_len)] = '\0';
+}
@@ -48,4 +48,79 @@ static inline uintptr_t random_shuffle(uintptr_t x)
     return x;
 }
 
+/* Fast generator of pseudo-random numbers, for test data rather than secrets.
+ *
+ * This is xoshiro256** by David Blackman and Sebastiano Vigna, seeded through
+ * splitmix64, see: <https://prng.di.unimi.it/>. The same seed always gives
+ * the same numbers, so that runs can be repeated.
+ */
+typedef struct {
+    uint64_t s[4];
+} prng_t;
+
+static inline uint64_t splitmix64(uint64_t *x)
+{
+    uint64_t z = (*x += 0x9e3779b97f4a7c15ULL);
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+    return z ^ (z >> 31);
+}
+
+/* Start the numbers of r over, from seed */
+static inline void prng_seed(prng_t *r, uint64_t seed)
+{
+    /* splitmix64 never gives four zeros in a row, which xoshiro gets stuck on
+     */
+    for (int i = 0; i < 4; i++)
+        r->s[i] = splitmix64(&seed);
+}
+
+static inline uint64_t prng_rotl(uint64_t x, int k)
+{
+    return (x << k) | (x >> (64 - k));
+}
+
+static inline uint64_t prng_next(prng_t *r)
+{
+    uint64_t *s = r->s;
+    uint64_t result = prng_rotl(s[1] * 5, 7) * 9;
+    uint64_t t = s[1] << 17;
+
+    s[2] ^= s[0];
+    s[3] ^= s[1];
+    s[1] ^= s[2];
+    s[0] ^= s[3];
+    s[2] ^= t;
+    s[3] = prng_rotl(s[3], 45);
+    return result;
+}
+
+/* Return a number from 0 to n - 1, n being below 2^32, without division */
+static inline uint32_t prng_below(prng_t *r, uint32_t n)
+{
+    return ((prng_next(r) >> 32) * n) >> 32;
+}
+
+/**
+ * random_strings() - Fill buffers with random strings
+ * @r: generator of the strings
+ * @bufs: @n buffers of @stride bytes each, one after the other
+ * @n: number of strings
+ * @stride: size of each buffer, the longest string being one byte shorter
+ * @min_len: length of the shortest string, below @stride
+ * @charset: characters the strings are made of
+ * @nchars: number of characters in @charset, 1 to 256
+ *
+ * Lengths are uniform from @min_len to @stride - 1. All the buffers are
+ * filled at once, eight bytes from every number, and then mapped to
+ * @charset in a single pass over them.
+ */
+void random_strings(prng_t *r,
+                    char *bufs,
+                    size_t n,
+                    size_t stride,
+                    size_t min_len,
+                    const char *charset,
+                    size_t nchars);
+
 #endif
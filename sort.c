@@ -0,0 +1,352 @@
+#include <pthread.h>
+#include <signal.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "radix.h"
+#include "sort.h"
+#include "timsort.h"
+
+int sort_alg = SORT_TIM;
+int sort_threads = 1;
+
+/* Upper bound of sort_threads */
+#define SORT_MAX_THREADS 64
+
+/* Segments shorter than this are not worth a thread of their own */
+#define SORT_MIN_SEGMENT 4096
+
+/* Comparisons made by the most recent q_sort() */
+static size_t sort_cmps;
+
+/* Scratch memory for SORT_RADIX, holding two items per element */
+static radix_item_t *sort_scratch;
+static size_t sort_scratch_len;
+
+/**
+ * sort_ctx_t - State of a sort, passed to the comparison function
+ * @descend: whether to sort in descending order
+ * @cmps: number of comparisons made
+ * @scratch: scratch memory of SORT_RADIX, NULL to sort the list in place
+ */
+typedef struct {
+    bool descend;
+    size_t cmps;
+    radix_item_t *scratch;
+} sort_ctx_t;
+
+static int sort_cmp(void *priv,
+                    const struct list_head *a,
+                    const struct list_head *b)
+{
+    sort_ctx_t *ctx = priv;
+    int cmp = element_cmp(list_entry(a, element_t, list),
+                          list_entry(b, element_t, list));
+    ctx->cmps++;
+    return ctx->descend ? -cmp : cmp;
+}
+
+/* Gather the n elements of a list into items, sort them there and relink the
+ * list in one pass. aux has room for n items as well.
+ */
+static size_t sort_radix(struct list_head *head,
+                         radix_item_t *items,
+                         radix_item_t *aux,
+                         bool descend)
+{
+    size_t n = 0;
+    element_t *e;
+    list_for_each_entry (e, head, list)
+        items[n++].e = e;
+
+    size_t cmps = radix_sort(items, aux, n, descend);
+
+    struct list_head *prev = head;
+    for (size_t i = 0; i < n; i++) {
+        struct list_head *node = &items[i].e->list;
+        prev->next = node;
+        node->prev = prev;
+        prev = node;
+    }
+    prev->next = head;
+    head->prev = prev;
+    return cmps;
+}
+
+/* Sort a list, whose elements start at offset in the list passed to
+ * element_sort(), with the selected algorithm
+ */
+static void sort_list(sort_ctx_t *ctx, struct list_head *head, size_t offset)
+{
+    if (ctx->scratch) {
+        radix_item_t *items = ctx->scratch + offset;
+        ctx->cmps += sort_radix(head, items, items + sort_scratch_len,
+                                ctx->descend);
+    } else if (sort_alg == SORT_MERGE) {
+        list_sort(ctx, head, sort_cmp);
+    } else {
+        timsort(ctx, head, sort_cmp);
+    }
+}
+
+/**
+ * sort_task_t - Share of a multithreaded sort
+ * @head: head of the segment of the list sorted by this task
+ * @list: the sorted segment, as a null-terminated singly-linked list
+ * @offset: position of the segment in the list
+ * @len: number of elements in the segment
+ * @partner: task whose list gets merged into @list next
+ * @ctx: comparisons made by this task
+ */
+typedef struct sort_task {
+    struct list_head head;
+    struct list_head *list;
+    size_t offset, len;
+    struct sort_task *partner;
+    sort_ctx_t ctx;
+} sort_task_t;
+
+static void *sort_segment(void *arg)
+{
+    sort_task_t *t = arg;
+    sort_list(&t->ctx, &t->head, t->offset);
+    t->head.prev->next = NULL;
+    t->list = t->head.next;
+    return NULL;
+}
+
+static void *merge_segments(void *arg)
+{
+    sort_task_t *t = arg, *p = t->partner;
+    t->list = __list_merge(&t->ctx, sort_cmp, t->list, p->list);
+    return NULL;
+}
+
+/* Run fn on each task, each on a thread of its own, and wait for them all.
+ * Tasks left without a thread run here. Called with every signal blocked,
+ * which the threads inherit.
+ */
+static void run_tasks(void *(*fn)(void *), sort_task_t **tasks, size_t n)
+{
+    pthread_t tid[SORT_MAX_THREADS];
+    size_t started = 0;
+
+    while (started < n &&
+           !pthread_create(&tid[started], NULL, fn, tasks[started]))
+        started++;
+    for (size_t i = started; i < n; i++)
+        fn(tasks[i]);
+    for (size_t i = 0; i < started; i++)
+        pthread_join(tid[i], NULL);
+}
+
+/* Split the list into nr contiguous segments, sort each of them on its own
+ * thread, then merge neighbouring segments pairwise, the merges of a round
+ * running in parallel as well. Ties go to the segment coming first, so the
+ * result is the same as the one of a single-threaded stable sort.
+ *
+ * Signals are blocked throughout, so that the alarm of the harness cannot
+ * unwind the calling thread while workers still use the list and the tasks
+ * on its stack, nor leave the list in pieces. An expired time limit is
+ * handled once the list is whole again.
+ */
+static void sort_parallel(struct list_head *head,
+                          size_t n,
+                          size_t nr,
+                          const sort_ctx_t *ctx)
+{
+    sort_task_t tasks[SORT_MAX_THREADS];
+    sort_task_t *run[SORT_MAX_THREADS];
+    struct list_head *node = head->next;
+    sigset_t all, old;
+
+    sigfillset(&all);
+    pthread_sigmask(SIG_BLOCK, &all, &old);
+    for (size_t i = 0, offset = 0; i < nr; i++) {
+        sort_task_t *t = &tasks[i];
+        size_t len = n / nr + (i < n % nr);
+        t->offset = offset;
+        t->len = len;
+        t->ctx = *ctx;
+
+        /* Detach the next len nodes into the segment */
+        struct list_head *last = node;
+        for (size_t j = 1; j < len; j++)
+            last = last->next;
+        t->head.next = node;
+        node->prev = &t->head;
+        node = last->next;
+        last->next = &t->head;
+        t->head.prev = last;
+
+        offset += len;
+        run[i] = t;
+    }
+    run_tasks(sort_segment, run, nr);
+
+    for (size_t step = 1; step < nr; step *= 2) {
+        size_t nr_merges = 0;
+        for (size_t i = 0; i + step < nr; i += 2 * step) {
+            tasks[i].partner = &tasks[i + step];
+            run[nr_merges++] = &tasks[i];
+        }
+        run_tasks(merge_segments, run, nr_merges);
+    }
+
+    /* Restore the prev links */
+    struct list_head *prev = head;
+    for (node = tasks[0].list; node; node = node->next) {
+        node->prev = prev;
+        prev->next = node;
+        prev = node;
+    }
+    prev->next = head;
+    head->prev = prev;
+
+    sort_cmps = 0;
+    for (size_t i = 0; i < nr; i++)
+        sort_cmps += tasks[i].ctx.cmps;
+    pthread_sigmask(SIG_SETMASK, &old, NULL);
+}
+
+bool q_sort_reserve(struct list_head *head)
+{
+    if (!head || sort_alg != SORT_RADIX)
+        return true;
+
+    size_t n = q_size(head);
+    if (n <= sort_scratch_len)
+        return true;
+
+    q_sort_release();
+    sort_scratch = malloc(2 * n * sizeof(radix_item_t));
+    if (!sort_scratch)
+        return false;
+    sort_scratch_len = n;
+    return true;
+}
+
+void q_sort_release()
+{
+    free(sort_scratch);
+    sort_scratch = NULL;
+    sort_scratch_len = 0;
+}
+
+void element_sort(struct list_head *head, size_t n, bool descend)
+{
+    sort_ctx_t ctx = {.descend = descend, .cmps = 0, .scratch = NULL};
+    if (sort_alg == SORT_RADIX && n <= sort_scratch_len)
+        ctx.scratch = sort_scratch;
+
+    size_t nr = sort_threads < 1 ? 1 : sort_threads;
+    if (nr > SORT_MAX_THREADS)
+        nr = SORT_MAX_THREADS;
+    if (nr > n / SORT_MIN_SEGMENT)
+        nr = n / SORT_MIN_SEGMENT;
+
+    if (nr > 1) {
+        sort_parallel(head, n, nr, &ctx);
+    } else {
+        sort_list(&ctx, head, 0);
+        sort_cmps = ctx.cmps;
+    }
+}
+
+void sort_skipped()
+{
+    sort_cmps = 0;
+}
+
+size_t q_sort_comparisons()
+{
+    return sort_cmps;
+}
+
+/**
+ * loser_tree_t - Tournament between the heads of sorted lists
+ * @src: the lists, emptied as their nodes are merged
+ * @tree: loser of the match played at each internal node, nodes being
+ *        numbered like in a binary heap with the lists as leaves @k to 2@k-1
+ * @k: number of lists, up to %MERGE_FANIN
+ * @descend: whether the lists are sorted in descending order
+ */
+typedef struct {
+    struct list_head *src[MERGE_FANIN];
+    unsigned int tree[MERGE_FANIN];
+    unsigned int k;
+    bool descend;
+} loser_tree_t;
+
+/* Test whether the head of list i goes before the head of list j. Exhausted
+ * lists lose every match, and ties go to the list coming first in the chain.
+ */
+static inline bool lt_beats(const loser_tree_t *lt,
+                            unsigned int i,
+                            unsigned int j)
+{
+    if (list_empty(lt->src[i]))
+        return false;
+    if (list_empty(lt->src[j]))
+        return true;
+
+    int cmp = element_cmp(list_first_entry(lt->src[i], element_t, list),
+                          list_first_entry(lt->src[j], element_t, list));
+    if (lt->descend)
+        cmp = -cmp;
+    return cmp < 0 || (!cmp && i < j);
+}
+
+/* Play the matches of the subtree rooted at node and return its winner */
+static unsigned int lt_build(loser_tree_t *lt, unsigned int node)
+{
+    if (node >= lt->k)
+        return node - lt->k;
+
+    unsigned int a = lt_build(lt, 2 * node), b = lt_build(lt, 2 * node + 1);
+    if (lt_beats(lt, a, b)) {
+        lt->tree[node] = b;
+        return a;
+    }
+    lt->tree[node] = a;
+    return b;
+}
+
+/* Each node costs one match per level of the tree, that is O(log k)
+ * comparisons.
+ */
+void element_merge(struct list_head **lists, unsigned int k, bool descend)
+{
+    if (k < 2)
+        return;
+
+    loser_tree_t tree = {.k = k, .descend = descend}, *lt = &tree;
+    unsigned int active = 0;
+    struct list_head *dst = lists[0];
+    memcpy(lt->src, lists, k * sizeof(*lists));
+
+    /* Compete with the original elements of dst from a separate list */
+    LIST_HEAD(first);
+    list_splice_init(dst, &first);
+    lt->src[0] = &first;
+    for (unsigned int i = 0; i < k; i++)
+        active += !list_empty(lt->src[i]);
+
+    unsigned int w = lt_build(lt, 1);
+    while (active > 1) {
+        list_move_tail(lt->src[w]->next, dst);
+        if (list_empty(lt->src[w]))
+            active--;
+
+        /* Replay the matches on the path from the leaf of w to the root */
+        for (unsigned int node = (w + k) / 2; node; node /= 2) {
+            if (lt_beats(lt, lt->tree[node], w)) {
+                unsigned int t = lt->tree[node];
+                lt->tree[node] = w;
+                w = t;
+            }
+        }
+    }
+    /* Whatever remains is already in order */
+    list_splice_tail_init(lt->src[w], dst);
+}
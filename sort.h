@@ -0,0 +1,43 @@
+#ifndef LAB0_SORT_H
+#define LAB0_SORT_H
+
+/* Sorting and merging of lists of elements, linked through their list
+ * member, shared by the queue implementations.
+ *
+ * The settings and scratch memory of q_sort(), see queue.h, live here too.
+ */
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "queue.h"
+
+/* Lists merged at once by element_merge() */
+#define MERGE_FANIN 256
+
+/**
+ * element_sort() - Sort a list of elements the way q_sort() does
+ * @head: head of the list
+ * @n: number of elements in the list
+ * @descend: whether or not to sort in descending order
+ *
+ * The algorithm and number of threads are taken from sort_alg and
+ * sort_threads. The sort is stable and never allocates memory.
+ */
+void element_sort(struct list_head *head, size_t n, bool descend);
+
+/* Record that q_sort() found the queue already sorted, without comparing */
+void sort_skipped();
+
+/**
+ * element_merge() - Merge sorted lists of elements into the first one
+ * @lists: heads of the lists, all but the first being left empty
+ * @k: number of lists, up to %MERGE_FANIN
+ * @descend: whether the lists are sorted in descending order
+ *
+ * A loser tree picks the next element among the heads of the lists. Equal
+ * elements keep the order of their lists in @lists.
+ */
+void element_merge(struct list_head **lists, unsigned int k, bool descend);
+
+#endif /* LAB0_SORT_H */
@@ -0,0 +1,113 @@
+#ifndef LAB0_STRHASH_H
+#define LAB0_STRHASH_H
+
+/* Fast hash of byte strings of known length, after wyhash final version 4
+ * by Wang Yi, released into the public domain.
+ *
+ * Reference: https://github.com/wangyi-fudan/wyhash
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#define STRHASH_P0 0x2d358dccaa6c78a5ULL
+#define STRHASH_P1 0x8bb84b93962eacc9ULL
+#define STRHASH_P2 0x4b33a62ed433d4a3ULL
+#define STRHASH_P3 0x4d5a2da51de1aa47ULL
+
+/* Multiply a by b and store the low and high halves in a and b */
+static inline void strhash_mum(uint64_t *a, uint64_t *b)
+{
+    __uint128_t r = (__uint128_t) *a * *b;
+    *a = (uint64_t) r;
+    *b = (uint64_t) (r >> 64);
+}
+
+static inline uint64_t strhash_mix(uint64_t a, uint64_t b)
+{
+    strhash_mum(&a, &b);
+    return a ^ b;
+}
+
+static inline uint64_t strhash_r8(const uint8_t *p)
+{
+    uint64_t v;
+    memcpy(&v, p, 8);
+    return v;
+}
+
+static inline uint64_t strhash_r4(const uint8_t *p)
+{
+    uint32_t v;
+    memcpy(&v, p, 4);
+    return v;
+}
+
+/* Read one to three bytes */
+static inline uint64_t strhash_r3(const uint8_t *p, size_t k)
+{
+    return ((uint64_t) p[0] << 16) | ((uint64_t) p[k >> 1] << 8) | p[k - 1];
+}
+
+/**
+ * strhash() - Hash a byte string
+ * @key: the bytes to hash
+ * @len: number of bytes
+ * @seed: value to start from, different seeds giving unrelated hashes
+ *
+ * Strings of up to 16 bytes are read with at most four loads, without any
+ * loop. The result is not meant to be cryptographically secure.
+ *
+ * Return: the 64-bit hash value
+ */
+static inline uint64_t strhash(const void *key, size_t len, uint64_t seed)
+{
+    const uint8_t *p = key;
+    uint64_t a, b;
+
+    seed ^= strhash_mix(seed ^ STRHASH_P0, STRHASH_P1);
+    if (len <= 16) {
+        if (len >= 4) {
+            size_t d = (len >> 3) << 2;
+            a = (strhash_r4(p) << 32) | strhash_r4(p + d);
+            b = (strhash_r4(p + len - 4) << 32) | strhash_r4(p + len - 4 - d);
+        } else if (len > 0) {
+            a = strhash_r3(p, len);
+            b = 0;
+        } else {
+            a = b = 0;
+        }
+    } else {
+        size_t i = len;
+        if (i > 48) {
+            uint64_t s1 = seed, s2 = seed;
+            do {
+                seed = strhash_mix(strhash_r8(p) ^ STRHASH_P1,
+                                   strhash_r8(p + 8) ^ seed);
+                s1 = strhash_mix(strhash_r8(p + 16) ^ STRHASH_P2,
+                                 strhash_r8(p + 24) ^ s1);
+                s2 = strhash_mix(strhash_r8(p + 32) ^ STRHASH_P3,
+                                 strhash_r8(p + 40) ^ s2);
+                p += 48;
+                i -= 48;
+            } while (i > 48);
+            seed ^= s1 ^ s2;
+        }
+        while (i > 16) {
+            seed = strhash_mix(strhash_r8(p) ^ STRHASH_P1,
+                               strhash_r8(p + 8) ^ seed);
+            i -= 16;
+            p += 16;
+        }
+        a = strhash_r8(p + i - 16);
+        b = strhash_r8(p + i - 8);
+    }
+
+    a ^= STRHASH_P1;
+    b ^= seed;
+    strhash_mum(&a, &b);
+    return strhash_mix(a ^ STRHASH_P0 ^ len, b ^ STRHASH_P1);
+}
+
+#endif /* LAB0_STRHASH_H */
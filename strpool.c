@@ -0,0 +1,120 @@
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "harness.h"
+#include "strhash.h"
+#include "strpool.h"
+
+/* Size of the hash table once the first string is interned */
+#define STRPOOL_MIN_BUCKETS 64
+
+/**
+ * strblock_t - Header of the storage of a string
+ * @next: next interned string in the same bucket
+ * @hash: hash of the string, if interned
+ * @len: length of the string
+ * @refs: number of references to the string
+ * @interned: whether the string is in the hash table
+ * @str: the string itself
+ */
+typedef struct strblock {
+    struct strblock *next;
+    uint64_t hash;
+    size_t len;
+    size_t refs;
+    bool interned;
+    char str[];
+} strblock_t;
+
+/* Interned strings, chained in a power-of-two number of buckets. The table
+ * goes away with the last interned string, so that an idle pool holds no
+ * memory at all.
+ */
+static strblock_t **buckets;
+static size_t nr_buckets, nr_interned;
+
+static inline strblock_t *to_block(char *str)
+{
+    return (strblock_t *) (str - offsetof(strblock_t, str));
+}
+
+/* Double the number of buckets, keeping the table as is on failure */
+static void table_grow(void)
+{
+    size_t n = nr_buckets ? 2 * nr_buckets : STRPOOL_MIN_BUCKETS;
+    strblock_t **table = malloc(n * sizeof(strblock_t *));
+    if (!table)
+        return;
+    memset(table, 0, n * sizeof(strblock_t *));
+
+    for (size_t i = 0; i < nr_buckets; i++) {
+        strblock_t *b = buckets[i];
+        while (b) {
+            strblock_t *next = b->next;
+            b->next = table[b->hash & (n - 1)];
+            table[b->hash & (n - 1)] = b;
+            b = next;
+        }
+    }
+    free(buckets);
+    buckets = table;
+    nr_buckets = n;
+}
+
+char *strpool_get(const char *s, size_t len, bool intern)
+{
+    uint64_t hash = 0;
+    if (intern) {
+        hash = strhash(s, len, 0);
+        if (nr_buckets) {
+            strblock_t *b = buckets[hash & (nr_buckets - 1)];
+            for (; b; b = b->next) {
+                if (b->hash == hash && b->len == len &&
+                    !memcmp(b->str, s, len)) {
+                    b->refs++;
+                    return b->str;
+                }
+            }
+        }
+        /* Keep chains short on average, even if growing fails */
+        if (nr_interned >= nr_buckets)
+            table_grow();
+    }
+
+    strblock_t *b = malloc(sizeof(strblock_t) + len + 1);
+    if (!b)
+        return NULL;
+    memcpy(b->str, s, len);
+    b->str[len] = '\0';
+    b->hash = hash;
+    b->len = len;
+    b->refs = 1;
+    b->interned = intern && nr_buckets;
+    if (b->interned) {
+        b->next = buckets[hash & (nr_buckets - 1)];
+        buckets[hash & (nr_buckets - 1)] = b;
+        nr_interned++;
+    }
+    return b->str;
+}
+
+void strpool_put(char *str)
+{
+    strblock_t *b = to_block(str);
+    if (--b->refs)
+        return;
+
+    if (b->interned) {
+        strblock_t **pp = &buckets[b->hash & (nr_buckets - 1)];
+        while (*pp != b)
+            pp = &(*pp)->next;
+        *pp = b->next;
+        if (!--nr_interned) {
+            free(buckets);
+            buckets = NULL;
+            nr_buckets = 0;
+        }
+    }
+    free(b);
+}
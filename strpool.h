@@ -0,0 +1,26 @@
+#ifndef LAB0_STRPOOL_H
+#define LAB0_STRPOOL_H
+
+/* Reference-counted storage for strings.
+ *
+ * Every string is allocated along with a small header holding its reference
+ * count. Interned strings are also entered in a hash table, so that asking
+ * for the same contents again hands out the same storage, with one more
+ * reference, instead of a new copy.
+ */
+
+#include <stdbool.h>
+#include <stddef.h>
+
+/* Return storage holding a copy of the len bytes of s plus a terminator, or
+ * NULL when it cannot be allocated. With intern, an interned copy of the
+ * same string is shared if there is one, and the copy is interned otherwise.
+ */
+char *strpool_get(const char *s, size_t len, bool intern);
+
+/* Drop a reference to storage returned by strpool_get(), releasing it along
+ * with the last reference.
+ */
+void strpool_put(char *str);
+
+#endif /* LAB0_STRPOOL_H */
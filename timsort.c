@@ -0,0 +1,319 @@
+#include <stdbool.h>
+#include <stddef.h>
+#include <string.h>
+
+#include "timsort.h"
+
+/* Runs shorter than this are extended with binary insertion */
+#define MIN_MERGE 64
+
+/* Consecutive wins of one run before switching to galloping */
+#define MIN_GALLOP 7
+
+/* Enough for any list that fits in memory, given the run invariants */
+#define MAX_RUNS 85
+
+/* A run is a null-terminated singly-linked list of sorted nodes */
+typedef struct {
+    struct list_head *head;
+    size_t len;
+} run_t;
+
+typedef struct {
+    void *priv;
+    list_cmp_func_t cmp;
+    run_t runs[MAX_RUNS];
+    size_t nr_runs;
+} sort_state_t;
+
+static inline bool le(sort_state_t *s,
+                      const struct list_head *a,
+                      const struct list_head *b)
+{
+    return s->cmp(s->priv, a, b) <= 0;
+}
+
+/* Return the smallest run length worth merging, see listsort.txt of CPython */
+static size_t min_run_length(size_t n)
+{
+    size_t r = 0;
+    while (n >= MIN_MERGE) {
+        r |= n & 1;
+        n >>= 1;
+    }
+    return n + r;
+}
+
+/* Detach the natural run at the beginning of *list. Strictly descending runs
+ * are reversed, so equal nodes never change their order.
+ */
+static run_t find_run(sort_state_t *s, struct list_head **list)
+{
+    struct list_head *head = *list, *next = head->next;
+    run_t run = {.head = head, .len = 1};
+
+    if (!next) {
+        *list = NULL;
+        return run;
+    }
+
+    if (!le(s, head, next)) {
+        /* Strictly descending: push every node in front of the run */
+        head->next = NULL;
+        do {
+            struct list_head *node = next;
+            next = next->next;
+            node->next = run.head;
+            run.head = node;
+            run.len++;
+        } while (next && !le(s, run.head, next));
+        *list = next;
+        return run;
+    }
+
+    struct list_head *tail = next;
+    run.len = 2;
+    while (tail->next && le(s, tail, tail->next)) {
+        tail = tail->next;
+        run.len++;
+    }
+    *list = tail->next;
+    tail->next = NULL;
+    return run;
+}
+
+/* Grow run up to minrun nodes taken from *list, using binary insertion */
+static void extend_run(sort_state_t *s,
+                       run_t *run,
+                       struct list_head **list,
+                       size_t minrun)
+{
+    struct list_head *buf[MIN_MERGE];
+    size_t n = 0;
+
+    for (struct list_head *node = run->head; node; node = node->next)
+        buf[n++] = node;
+
+    while (n < minrun && *list) {
+        struct list_head *node = *list;
+        *list = node->next;
+
+        /* Insert after every node comparing equal */
+        size_t lo = 0, hi = n;
+        while (lo < hi) {
+            size_t mid = (lo + hi) / 2;
+            if (le(s, buf[mid], node))
+                lo = mid + 1;
+            else
+                hi = mid;
+        }
+        memmove(&buf[lo + 1], &buf[lo], (n - lo) * sizeof(buf[0]));
+        buf[lo] = node;
+        n++;
+    }
+
+    for (size_t i = 0; i + 1 < n; i++)
+        buf[i]->next = buf[i + 1];
+    buf[n - 1]->next = NULL;
+    run->head = buf[0];
+    run->len = n;
+}
+
+/* Test whether node belongs in front of key: nodes of the left run go first
+ * on ties, nodes of the right run only when strictly less.
+ */
+static inline bool precedes(sort_state_t *s,
+                            const struct list_head *node,
+                            const struct list_head *key,
+                            bool left)
+{
+    return left ? le(s, node, key) : !le(s, key, node);
+}
+
+/* Return the last node of the longest prefix of run preceding key, NULL if
+ * there is none, and store the length of the prefix in *n. Probes are made
+ * at exponentially growing distances, then narrowed down by bisection, so
+ * only O(log n) comparisons are needed.
+ */
+static struct list_head *gallop(sort_state_t *s,
+                                struct list_head *run,
+                                const struct list_head *key,
+                                bool left,
+                                size_t *n)
+{
+    *n = 0;
+    if (!precedes(s, run, key, left))
+        return NULL;
+
+    struct list_head *last = run;
+    size_t count = 1, span = 0;
+    for (size_t step = 1;; step <<= 1) {
+        struct list_head *probe = last;
+        size_t i = 0;
+        while (i < step && probe->next) {
+            probe = probe->next;
+            i++;
+        }
+        if (!i)
+            break;
+        if (!precedes(s, probe, key, left)) {
+            span = i;
+            break;
+        }
+        last = probe;
+        count += i;
+    }
+
+    /* The answer lies strictly before the node span steps after last */
+    while (span > 1) {
+        size_t half = span / 2;
+        struct list_head *probe = last;
+        for (size_t i = 0; i < half; i++)
+            probe = probe->next;
+        if (precedes(s, probe, key, left)) {
+            last = probe;
+            count += half;
+            span -= half;
+        } else {
+            span = half;
+        }
+    }
+
+    *n = count;
+    return last;
+}
+
+/* Merge two adjacent runs, a coming first on ties */
+static struct list_head *merge(sort_state_t *s,
+                               struct list_head *a,
+                               struct list_head *b)
+{
+    struct list_head *head = NULL, **tail = &head;
+    size_t min_gallop = MIN_GALLOP;
+
+    while (a && b) {
+        size_t wins_a = 0, wins_b = 0;
+
+        /* One node at a time until a run seems to win consistently */
+        while (a && b && wins_a < min_gallop && wins_b < min_gallop) {
+            if (le(s, a, b)) {
+                *tail = a;
+                tail = &a->next;
+                a = a->next;
+                wins_a++;
+                wins_b = 0;
+            } else {
+                *tail = b;
+                tail = &b->next;
+                b = b->next;
+                wins_b++;
+                wins_a = 0;
+            }
+        }
+
+        /* Move whole blocks while galloping pays off */
+        while (a && b) {
+            size_t na, nb;
+            struct list_head *last = gallop(s, a, b, true, &na);
+            if (last) {
+                *tail = a;
+                tail = &last->next;
+                a = last->next;
+                if (!a)
+                    break;
+            }
+            last = gallop(s, b, a, false, &nb);
+            if (last) {
+                *tail = b;
+                tail = &last->next;
+                b = last->next;
+            }
+            if (na < MIN_GALLOP && nb < MIN_GALLOP) {
+                min_gallop++;
+                break;
+            }
+            if (min_gallop > 1)
+                min_gallop--;
+        }
+    }
+
+    *tail = a ? a : b;
+    return head;
+}
+
+/* Merge the runs at index i and i + 1 of the stack */
+static void merge_at(sort_state_t *s, size_t i)
+{
+    run_t *r = s->runs;
+    r[i].head = merge(s, r[i].head, r[i + 1].head);
+    r[i].len += r[i + 1].len;
+    if (i + 2 < s->nr_runs)
+        r[i + 1] = r[i + 2];
+    s->nr_runs--;
+}
+
+/* Restore the invariants on the lengths of the top runs A, B and C:
+ * A > B + C and B > C, checking one level deeper as well.
+ */
+static void merge_collapse(sort_state_t *s)
+{
+    run_t *r = s->runs;
+    while (s->nr_runs > 1) {
+        size_t i = s->nr_runs - 2;
+        if ((i > 0 && r[i - 1].len <= r[i].len + r[i + 1].len) ||
+            (i > 1 && r[i - 2].len <= r[i - 1].len + r[i].len)) {
+            if (r[i - 1].len < r[i + 1].len)
+                i--;
+        } else if (r[i].len > r[i + 1].len) {
+            break;
+        }
+        merge_at(s, i);
+    }
+}
+
+static void merge_force_collapse(sort_state_t *s)
+{
+    run_t *r = s->runs;
+    while (s->nr_runs > 1) {
+        size_t i = s->nr_runs - 2;
+        if (i > 0 && r[i - 1].len < r[i + 1].len)
+            i--;
+        merge_at(s, i);
+    }
+}
+
+void timsort(void *priv, struct list_head *head, list_cmp_func_t cmp)
+{
+    /* Zero or one node */
+    if (head->next == head->prev)
+        return;
+
+    sort_state_t s = {.priv = priv, .cmp = cmp, .nr_runs = 0};
+    struct list_head *list = head->next;
+    size_t n = 0;
+
+    /* Convert to a null-terminated singly-linked list */
+    head->prev->next = NULL;
+    for (struct list_head *node = list; node; node = node->next)
+        n++;
+    size_t minrun = min_run_length(n);
+
+    while (list) {
+        run_t run = find_run(&s, &list);
+        if (run.len < minrun)
+            extend_run(&s, &run, &list, minrun);
+        s.runs[s.nr_runs++] = run;
+        merge_collapse(&s);
+    }
+    merge_force_collapse(&s);
+
+    /* Restore the prev links */
+    struct list_head *prev = head;
+    for (struct list_head *node = s.runs[0].head; node; node = node->next) {
+        node->prev = prev;
+        prev->next = node;
+        prev = node;
+    }
+    prev->next = head;
+    head->prev = prev;
+}
@@ -0,0 +1,22 @@
+#ifndef LAB0_TIMSORT_H
+#define LAB0_TIMSORT_H
+
+#include "list.h"
+
+/**
+ * timsort() - Sort the list nodes with an adaptive natural merge sort
+ * @priv: private data passed to @cmp
+ * @head: pointer to the head of the list
+ * @cmp: comparison function, see list_sort()
+ *
+ * The list is split into natural runs, strictly descending runs being
+ * reversed in place. Runs shorter than a minimum length are extended with
+ * binary insertion, then merged following the invariants of Timsort, with
+ * galloping when one run keeps winning. Presorted input, in either order,
+ * is sorted with n - 1 comparisons.
+ *
+ * Nodes comparing equal keep their relative order. No memory is allocated.
+ */
+void timsort(void *priv, struct list_head *head, list_cmp_func_t cmp);
+
+#endif /* LAB0_TIMSORT_H */
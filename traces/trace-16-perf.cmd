@@ -1,4 +1,4 @@
-# Test performance of insert_tail
+# Test performance of insert_tail, and of draining the queue
 option fail 0
 option malloc 0
 new
@@ -6,3 +6,8 @@ ih dolphin 1000000
 it gerbil 1000
 reverse
 it jaguar 1000
+rh gerbil
+rh * 1000999
+rh jaguar
+rt * 999
+size
@@ -0,0 +1,25 @@
+# Test of sort by radix with strings sharing an 8-character prefix
+option fail 0
+option malloc 0
+option sortalg radix
+new
+it abcdefghi
+it abcdefgh
+it abcdefghij
+it abcdefgh
+it abcdefg
+sort
+rh abcdefg
+rh abcdefgh
+rh abcdefgh
+rh abcdefghi
+rh abcdefghij
+it abcdefgh
+it abcdefghij
+it abcdefghi
+option descend 1
+sort
+rh abcdefghij
+rh abcdefghi
+rh abcdefgh
+free